@@ -0,0 +1,425 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timer.h"
+#include "ecs.h"
+
+//every trial builds its world outside the timed region and reports the nanoseconds of the timed part only.
+//Results go to stdout as CSV (default) or JSON, one record per benchmark.
+
+#define NUMBER_OF_TAGS 6
+volatile double g_sink = 0.0;
+
+typedef struct BenchConfig {
+    id_t number_of_entities;
+    uint32_t number_of_trials;
+    uint32_t max_threads;
+    chunk_size_t chunk_rows;
+    const char* filter;
+    bool json;
+} BenchConfig;
+
+typedef struct BenchTrial {
+    uint64_t ns;
+    //entities or operations the timed part handled
+    uint64_t operations;
+    //chunk, sparse array and id stack bytes over live entities at the end of the trial
+    double bytes_per_entity;
+} BenchTrial;
+
+typedef BenchTrial (*BenchFunction)(const BenchConfig* config, uint32_t number_of_threads);
+
+typedef struct Benchmark {
+    const char* name;
+    BenchFunction run;
+    bool scales_with_threads;
+} Benchmark;
+
+typedef struct BenchComponents {
+    comp_id_t position;
+    comp_id_t velocity;
+    comp_id_t health;
+    comp_id_t tags[NUMBER_OF_TAGS];
+} BenchComponents;
+
+
+//Helper Functions
+static uint64_t random_state = 0x2545F4914F6CDD1Dull;
+
+static uint64_t random_next(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static void shuffle_ids(id_t* ids, const id_t number_of_ids) {
+    for (id_t i = number_of_ids; i > 1; i--) {
+        const id_t j = (id_t)(random_next() % i);
+        const id_t swap = ids[i - 1];
+        ids[i - 1] = ids[j];
+        ids[j] = swap;
+    }
+}
+
+static World bench_world(const BenchConfig* config, BenchComponents* components) {
+    World world = world_create(config->chunk_rows, config->chunk_rows, 1);
+    const comp_size_t vector_fields[] = {sizeof(double), sizeof(double), sizeof(double)};
+    const comp_size_t health_fields[] = {sizeof(float)};
+    components->position = world_add_component_type(&world, vector_fields, 3);
+    components->velocity = world_add_component_type(&world, vector_fields, 3);
+    components->health = world_add_component_type(&world, health_fields, 1);
+    for (uint32_t t = 0; t < NUMBER_OF_TAGS; t++) {
+        components->tags[t] = world_add_component_type(&world, NULL, 0);
+    }
+    return world;
+}
+
+static id_t* bench_spawn(World* world, const BenchComponents* components, const id_t number_of_entities) {
+    id_t* ids = malloc(sizeof(id_t) * number_of_entities);
+    if(!ids) exit(EXIT_FAILURE);
+    const comp_id_t moving[] = {components->position, components->velocity};
+    world_add_entities(world, number_of_entities, 2, moving, ids, NULL);
+    return ids;
+}
+
+static double bytes_per_entity(const World* world) {
+    WorldStats stats = world_get_stats(world);
+    const size_t bytes = stats.chunk_bytes_allocated + stats.sparse_array_bytes + stats.id_stack_bytes;
+    const double result = stats.number_of_entities ? (double)bytes / (double)stats.number_of_entities : 0.0;
+    world_stats_destroy(&stats);
+    return result;
+}
+
+static double integrate_chunk(void*** fields, const chunk_size_t begin, const chunk_size_t end) {
+    double* x = fields[0][0];
+    double* y = fields[0][1];
+    double* z = fields[0][2];
+    const double* dx = fields[1][0];
+    const double* dy = fields[1][1];
+    const double* dz = fields[1][2];
+    double sum = 0.0;
+    for (chunk_size_t i = begin; i < end; i++) {
+        x[i] += dx[i];
+        y[i] += dy[i];
+        z[i] += dz[i];
+        sum += x[i];
+    }
+    return sum;
+}
+
+static void integrate_job(void*** fields, const chunk_size_t begin, const chunk_size_t end, void* user_data) {
+    (void)user_data;
+    integrate_chunk(fields, begin, end);
+}
+
+static double integrate_iterator(const ComponentIterator* iterator) {
+    double sum = 0.0;
+    for (chunks_length_t c = 0; c < iterator->number_of_chunks; c++) {
+        sum += integrate_chunk(iterator->component_field_arrays[c], 0, iterator->chunk_lengths[c]);
+    }
+    return sum;
+}
+
+
+//Benchmark Functions
+static BenchTrial bench_spawn_batch(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    const comp_id_t moving[] = {components.position, components.velocity};
+
+    const uint64_t start = timer_now_ns();
+    world_add_entities(&world, config->number_of_entities, 2, moving, NULL, NULL);
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, config->number_of_entities, bytes_per_entity(&world) };
+    world_destroy(&world);
+    return trial;
+}
+
+static BenchTrial bench_spawn_single(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    const comp_id_t moving[] = {components.position, components.velocity};
+
+    const uint64_t start = timer_now_ns();
+    for (id_t i = 0; i < config->number_of_entities; i++) {
+        world_add_entity(&world, 2, moving);
+    }
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, config->number_of_entities, bytes_per_entity(&world) };
+    world_destroy(&world);
+    return trial;
+}
+
+static BenchTrial bench_random_access(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    id_t* ids = bench_spawn(&world, &components, config->number_of_entities);
+    shuffle_ids(ids, config->number_of_entities);
+
+    const uint64_t start = timer_now_ns();
+    double sum = 0.0;
+    for (id_t i = 0; i < config->number_of_entities; i++) {
+        sum += *(const double*)world_get_component_field(&world, ids[i], components.position, 0);
+    }
+    const uint64_t end = timer_now_ns();
+    g_sink += sum;
+
+    BenchTrial trial = { end - start, config->number_of_entities, bytes_per_entity(&world) };
+    free(ids);
+    world_destroy(&world);
+    return trial;
+}
+
+//removes a random half one by one and spawns as many again, so the released ids are reused
+static BenchTrial bench_remove_churn(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    id_t* ids = bench_spawn(&world, &components, config->number_of_entities);
+    shuffle_ids(ids, config->number_of_entities);
+    const comp_id_t moving[] = {components.position, components.velocity};
+    const id_t half = config->number_of_entities / 2;
+
+    const uint64_t start = timer_now_ns();
+    for (id_t i = 0; i < half; i++) {
+        world_remove_entity(&world, ids[i]);
+    }
+    for (id_t i = 0; i < half; i++) {
+        world_add_entity(&world, 2, moving);
+    }
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, (uint64_t)half * 2, bytes_per_entity(&world) };
+    free(ids);
+    world_destroy(&world);
+    return trial;
+}
+
+//adds a component to every entity in random order and removes it again, each one a move between archetypes
+static BenchTrial bench_structural(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    id_t* ids = bench_spawn(&world, &components, config->number_of_entities);
+    shuffle_ids(ids, config->number_of_entities);
+
+    const uint64_t start = timer_now_ns();
+    for (id_t i = 0; i < config->number_of_entities; i++) {
+        world_add_component(&world, ids[i], components.health);
+    }
+    for (id_t i = 0; i < config->number_of_entities; i++) {
+        world_remove_component(&world, ids[i], components.health);
+    }
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, (uint64_t)config->number_of_entities * 2, bytes_per_entity(&world) };
+    free(ids);
+    world_destroy(&world);
+    return trial;
+}
+
+static BenchTrial bench_iterate(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    free(bench_spawn(&world, &components, config->number_of_entities));
+    const comp_id_t moving[] = {components.position, components.velocity};
+    const query_id_t query = world_add_query(&world, moving, 2);
+
+    const uint64_t start = timer_now_ns();
+    g_sink += integrate_iterator(world_get_query_iterator(&world, query));
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, config->number_of_entities, bytes_per_entity(&world) };
+    world_destroy(&world);
+    return trial;
+}
+
+//the entities are spread over 2^NUMBER_OF_TAGS archetypes that all match the query
+static BenchTrial bench_fragmented_query(const BenchConfig* config, const uint32_t number_of_threads) {
+    (void)number_of_threads;
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    const uint32_t number_of_archetypes = 1u << NUMBER_OF_TAGS;
+    for (uint32_t a = 0; a < number_of_archetypes; a++) {
+        comp_id_t list[2 + NUMBER_OF_TAGS] = {components.position, components.velocity};
+        comp_id_t length = 2;
+        for (uint32_t t = 0; t < NUMBER_OF_TAGS; t++) {
+            if (a & (1u << t)) {
+                list[length++] = components.tags[t];
+            }
+        }
+        const id_t begin = (id_t)((uint64_t)config->number_of_entities * a / number_of_archetypes);
+        const id_t end = (id_t)((uint64_t)config->number_of_entities * (a + 1) / number_of_archetypes);
+        world_add_entities(&world, end - begin, length, list, NULL, NULL);
+    }
+    const comp_id_t moving[] = {components.position, components.velocity};
+    const query_id_t query = world_add_query(&world, moving, 2);
+
+    const uint64_t start = timer_now_ns();
+    g_sink += integrate_iterator(world_get_query_iterator(&world, query));
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, config->number_of_entities, bytes_per_entity(&world) };
+    world_destroy(&world);
+    return trial;
+}
+
+static BenchTrial bench_parallel_iterate(const BenchConfig* config, const uint32_t number_of_threads) {
+    BenchComponents components;
+    World world = bench_world(config, &components);
+    free(bench_spawn(&world, &components, config->number_of_entities));
+    const comp_id_t moving[] = {components.position, components.velocity};
+    const query_id_t query = world_add_query(&world, moving, 2);
+    JobSystem* job_system = job_system_create(number_of_threads);
+
+    const uint64_t start = timer_now_ns();
+    world_query_for_each_parallel_cached(&world, job_system, query, integrate_job, NULL, 0);
+    const uint64_t end = timer_now_ns();
+
+    BenchTrial trial = { end - start, config->number_of_entities, bytes_per_entity(&world) };
+    job_system_destroy(job_system);
+    world_destroy(&world);
+    return trial;
+}
+
+static const Benchmark benchmarks[] = {
+    { "spawn_batch", bench_spawn_batch, false },
+    { "spawn_single", bench_spawn_single, false },
+    { "random_access", bench_random_access, false },
+    { "remove_churn", bench_remove_churn, false },
+    { "structural", bench_structural, false },
+    { "iterate", bench_iterate, false },
+    { "fragmented_query", bench_fragmented_query, false },
+    { "parallel_iterate", bench_parallel_iterate, true },
+};
+
+
+//Report Functions
+static int compare_u64(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+//nearest rank, so the p99 of fewer than 100 trials is the slowest one
+static uint64_t percentile(const uint64_t* sorted, const uint32_t count, const uint32_t percent) {
+    uint32_t rank = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void run_benchmark(const BenchConfig* config, const Benchmark* benchmark, const uint32_t number_of_threads, bool* first_record) {
+    uint64_t* times = malloc(sizeof(uint64_t) * config->number_of_trials);
+    if(!times) exit(EXIT_FAILURE);
+
+    //one warm-up trial that is not reported
+    BenchTrial trial = benchmark->run(config, number_of_threads);
+    for (uint32_t t = 0; t < config->number_of_trials; t++) {
+        trial = benchmark->run(config, number_of_threads);
+        times[t] = trial.ns;
+    }
+    qsort(times, config->number_of_trials, sizeof(uint64_t), compare_u64);
+
+    const uint64_t median = percentile(times, config->number_of_trials, 50);
+    const uint64_t p99 = percentile(times, config->number_of_trials, 99);
+    const double ns_per_entity = trial.operations ? (double)median / (double)trial.operations : 0.0;
+    if (config->json) {
+        printf("%s\n    {\"benchmark\": \"%s\", \"threads\": %u, \"entities\": %llu, \"operations\": %llu, \"trials\": %u, "
+               "\"min_ns\": %llu, \"median_ns\": %llu, \"p99_ns\": %llu, \"ns_per_entity\": %.3f, \"bytes_per_entity\": %.2f}",
+            *first_record ? "" : ",", benchmark->name, number_of_threads, (unsigned long long)config->number_of_entities,
+            (unsigned long long)trial.operations, config->number_of_trials, (unsigned long long)times[0],
+            (unsigned long long)median, (unsigned long long)p99, ns_per_entity, trial.bytes_per_entity);
+    } else {
+        printf("%s,%u,%llu,%llu,%u,%llu,%llu,%llu,%.3f,%.2f\n",
+            benchmark->name, number_of_threads, (unsigned long long)config->number_of_entities,
+            (unsigned long long)trial.operations, config->number_of_trials, (unsigned long long)times[0],
+            (unsigned long long)median, (unsigned long long)p99, ns_per_entity, trial.bytes_per_entity);
+    }
+    fflush(stdout);
+    *first_record = false;
+    free(times);
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "usage: %s [--format csv|json] [--entities N] [--trials N] [--threads N] [--chunk-rows N] [--filter NAME]\n"
+        "  --threads is the most threads parallel benchmarks scale to, 0 means one per hardware thread\n"
+        "  --filter runs only the benchmarks whose name contains NAME\n", program);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = {
+        .number_of_entities = 1000000,
+        .number_of_trials = 15,
+        .max_threads = 0,
+        .chunk_rows = 4096,
+        .filter = NULL,
+        .json = false
+    };
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--format") == 0 && has_value) {
+            config.json = strcmp(argv[++i], "json") == 0;
+        } else if (strcmp(argv[i], "--entities") == 0 && has_value) {
+            config.number_of_entities = (id_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--trials") == 0 && has_value) {
+            config.number_of_trials = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            config.max_threads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--chunk-rows") == 0 && has_value) {
+            config.chunk_rows = (chunk_size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            config.filter = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (config.number_of_entities < 2 || config.number_of_trials == 0 || config.chunk_rows == 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (config.max_threads == 0) {
+        JobSystem* probe = job_system_create(0);
+        config.max_threads = job_system_number_of_threads(probe);
+        job_system_destroy(probe);
+    }
+
+    bool first_record = true;
+    if (config.json) {
+        printf("{\n  \"results\": [");
+    } else {
+        printf("benchmark,threads,entities,operations,trials,min_ns,median_ns,p99_ns,ns_per_entity,bytes_per_entity\n");
+    }
+    for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+        const Benchmark* benchmark = &benchmarks[b];
+        if (config.filter && !strstr(benchmark->name, config.filter)) {
+            continue;
+        }
+        if (!benchmark->scales_with_threads) {
+            run_benchmark(&config, benchmark, 1, &first_record);
+            continue;
+        }
+        //1, 2, 4, ... threads and the maximum itself
+        for (uint32_t threads = 1; ; threads *= 2) {
+            if (threads > config.max_threads) {
+                threads = config.max_threads;
+            }
+            run_benchmark(&config, benchmark, threads, &first_record);
+            if (threads == config.max_threads) {
+                break;
+            }
+        }
+    }
+    if (config.json) {
+        printf("\n  ]\n}\n");
+    }
+    return 0;
+}
@@ -1,18 +1,220 @@
 #include "ecs.h"
 
 #include <assert.h>
+#include <stdatomic.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
 
-// Comparison function for qsort from stdlib
-static int compare_comp_ids(const void* a, const void* b) {
-    comp_id_t id_a = *(const comp_id_t*)a;
-    comp_id_t id_b = *(const comp_id_t*)b;
-    if (id_a < id_b) return -1;
-    if (id_a > id_b) return 1;
-    return 0;
+//profiler hooks, empty unless ECS_PROFILE_HEADER names a header that defines them (e.g. forwarding to
+//TracyCZoneN/TracyCZoneEnd and TracyCAlloc/TracyCFree). A zone's begin declares the variable its end takes.
+//The chunk hooks see every block the chunk allocator hands out or gets back, also from spawn stages on other threads.
+#ifdef ECS_PROFILE_HEADER
+#include ECS_PROFILE_HEADER
+#endif
+#ifndef ECS_PROFILE_ZONE_BEGIN
+#define ECS_PROFILE_ZONE_BEGIN(zone, name) ((void)0)
+#endif
+#ifndef ECS_PROFILE_ZONE_END
+#define ECS_PROFILE_ZONE_END(zone) ((void)0)
+#endif
+#ifndef ECS_PROFILE_CHUNK_ALLOCATE
+#define ECS_PROFILE_CHUNK_ALLOCATE(block, size) ((void)0)
+#endif
+#ifndef ECS_PROFILE_CHUNK_FREE
+#define ECS_PROFILE_CHUNK_FREE(block, size) ((void)0)
+#endif
+
+
+//ComponentMask Functions
+void component_mask_init(ComponentMask* this, const comp_id_t* components, const comp_id_t number_of_components) {
+    memset(this, 0, sizeof(ComponentMask));
+    for (comp_id_t i = 0; i < number_of_components; i++) {
+        this->words[components[i] / 64] |= (uint64_t)1 << (components[i] % 64);
+    }
+}
+
+static bool component_mask_has(const ComponentMask* mask, const comp_id_t component) {
+    return (mask->words[component / 64] >> (component % 64)) & 1;
+}
+
+static bool component_mask_contains(const ComponentMask* mask, const ComponentMask* subset) {
+    for (uint32_t w = 0; w < COMPONENT_MASK_WORDS; w++) {
+        if ((mask->words[w] & subset->words[w]) != subset->words[w]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool component_mask_intersects(const ComponentMask* a, const ComponentMask* b) {
+    for (uint32_t w = 0; w < COMPONENT_MASK_WORDS; w++) {
+        if (a->words[w] & b->words[w]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool component_mask_equals(const ComponentMask* a, const ComponentMask* b) {
+    for (uint32_t w = 0; w < COMPONENT_MASK_WORDS; w++) {
+        if (a->words[w] != b->words[w]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t component_mask_hash(const ComponentMask* mask) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for (uint32_t w = 0; w < COMPONENT_MASK_WORDS; w++) {
+        hash ^= mask->words[w];
+        hash *= 0xBF58476D1CE4E5B9ull;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+
+//QueryFilter Functions
+void query_filter_init(QueryFilter* this, const QueryDesc* desc) {
+    component_mask_init(&this->required, desc->required, desc->number_of_required);
+    component_mask_init(&this->excluded, desc->excluded, desc->number_of_excluded);
+    component_mask_init(&this->any_of, desc->any_of, desc->number_of_any_of);
+    this->has_any_of = desc->number_of_any_of > 0;
+}
+
+bool query_filter_matches(const QueryFilter* this, const ComponentMask* mask) {
+    return component_mask_contains(mask, &this->required) &&
+           !component_mask_intersects(mask, &this->excluded) &&
+           (!this->has_any_of || component_mask_intersects(mask, &this->any_of));
+}
+
+//the components behind the iterator columns, in column order
+static comp_id_t query_desc_columns(const QueryDesc* desc, comp_id_t* components) {
+    comp_id_t number_of_columns = 0;
+    for (comp_id_t i = 0; i < desc->number_of_required; i++) {
+        components[number_of_columns++] = desc->required[i];
+    }
+    for (comp_id_t i = 0; i < desc->number_of_optional; i++) {
+        components[number_of_columns++] = desc->optional[i];
+    }
+    for (comp_id_t i = 0; i < desc->number_of_any_of; i++) {
+        components[number_of_columns++] = desc->any_of[i];
+    }
+    return number_of_columns;
+}
+
+static comp_id_t query_desc_number_of_columns(const QueryDesc* desc) {
+    return desc->number_of_required + desc->number_of_optional + desc->number_of_any_of;
+}
+
+
+//ComponentSet Functions
+void component_set_init(ComponentSet* this, const comp_size_t number_of_fields) {
+    this->positions = NULL;
+    this->positions_capacity = 0;
+    this->first_index = 0;
+    this->ids = NULL;
+    this->count = 0;
+    this->capacity = 0;
+    this->fields = malloc(sizeof(void*) * number_of_fields);
+    if(!this->fields && number_of_fields) exit(EXIT_FAILURE);
+    for (comp_size_t f = 0; f < number_of_fields; f++) {
+        this->fields[f] = NULL;
+    }
+}
+
+void component_set_destroy(ComponentSet* this, const comp_size_t number_of_fields) {
+    for (comp_size_t f = 0; f < number_of_fields; f++) {
+        free(this->fields[f]);
+    }
+    free(this->fields);
+    free(this->ids);
+    free(this->positions);
+    this->fields = NULL;
+    this->ids = NULL;
+    this->positions = NULL;
+}
+
+//row of the entity's slot + 1, 0 if it has none
+id_t component_set_find(const ComponentSet* this, const id_t entity_id) {
+    //indexes below first_index wrap around and fail the bounds check
+    const id_t index = ENTITY_INDEX(entity_id) - this->first_index;
+    return index < this->positions_capacity ? this->positions[index] : 0;
+}
+
+//appends an uninitialized row unless the entity already has one, returns the row
+id_t component_set_insert(ComponentSet* this, const comp_size_t* field_sizes, const comp_size_t number_of_fields, const id_t entity_id) {
+    const id_t found = component_set_find(this, entity_id);
+    if (found) {
+        return found - 1;
+    }
+
+    const id_t index = ENTITY_INDEX(entity_id) - this->first_index;
+    if (index >= this->positions_capacity) {
+        id_t capacity = this->positions_capacity ? this->positions_capacity : 64;
+        while (index >= capacity) {
+            capacity *= 2;
+        }
+        this->positions = realloc(this->positions, sizeof(id_t) * capacity);
+        if(!this->positions) exit(EXIT_FAILURE);
+        memset(&this->positions[this->positions_capacity], 0, sizeof(id_t) * (capacity - this->positions_capacity));
+        this->positions_capacity = capacity;
+    }
+    if (this->count == this->capacity) {
+        this->capacity = this->capacity ? this->capacity * 2 : 16;
+        this->ids = realloc(this->ids, sizeof(id_t) * this->capacity);
+        if(!this->ids) exit(EXIT_FAILURE);
+        for (comp_size_t f = 0; f < number_of_fields; f++) {
+            this->fields[f] = realloc(this->fields[f], (size_t)field_sizes[f] * this->capacity);
+            if(!this->fields[f] && field_sizes[f]) exit(EXIT_FAILURE);
+        }
+    }
+
+    const id_t row = this->count++;
+    this->ids[row] = entity_id;
+    this->positions[index] = row + 1;
+    return row;
+}
+
+//swap-and-pop, nothing happens if the entity has no row
+void component_set_remove(ComponentSet* this, const comp_size_t* field_sizes, const comp_size_t number_of_fields, const id_t entity_id) {
+    const id_t found = component_set_find(this, entity_id);
+    if (!found) {
+        return;
+    }
+    const id_t row = found - 1;
+    const id_t last = --this->count;
+    if (row != last) {
+        const id_t moved_id = this->ids[last];
+        this->ids[row] = moved_id;
+        for (comp_size_t f = 0; f < number_of_fields; f++) {
+            uint8_t* field_array = this->fields[f];
+            memcpy(field_array + (size_t)row * field_sizes[f], field_array + (size_t)last * field_sizes[f], field_sizes[f]);
+        }
+        this->positions[ENTITY_INDEX(moved_id) - this->first_index] = row + 1;
+    }
+    this->positions[ENTITY_INDEX(entity_id) - this->first_index] = 0;
 }
 
 
@@ -20,7 +222,8 @@ static int compare_comp_ids(const void* a, const void* b) {
 void component_data_init(
     ComponentData* this,
     const comp_size_t* field_sizes,
-    const comp_size_t number_of_fields) {
+    const comp_size_t number_of_fields,
+    const ComponentStorage storage) {
 
     this->number_of_fields = number_of_fields;
     this->field_sizes = malloc(sizeof(comp_size_t) * number_of_fields);
@@ -28,96 +231,297 @@ void component_data_init(
     for (comp_size_t i=0; i<number_of_fields; i++) {
         this->field_sizes[i] = field_sizes[i];
     }
+    this->storage = storage;
+    if (storage == COMPONENT_STORAGE_SPARSE) {
+        component_set_init(&this->set, number_of_fields);
+    }
 }
 
 void component_data_destroy(ComponentData* this) {
+    if (this->storage == COMPONENT_STORAGE_SPARSE) {
+        component_set_destroy(&this->set, this->number_of_fields);
+    }
     free(this->field_sizes);
     this->field_sizes = NULL;
 }
 
 
-//ArchetypeDataChunk Functions
-void archetype_data_chunk_init(
-    ArchetypeDataChunk* this,
-    const ComponentData* all_components_data,
-    const comp_id_t number_of_all_components,
-    const comp_id_t number_of_archetype_components,
-    const comp_id_t* component_ids_of_archetype,
-    const size_t chunk_size) {
-
-    this->dense_arrays_length = 0;
+//ChunkPool Functions
+static void* default_chunk_allocate(const size_t size, const size_t alignment, void* user_data) {
+    (void)user_data;
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    return aligned_alloc(alignment, size);
+#endif
+}
 
-    this->id_dense_array = _aligned_malloc(sizeof(id_t) * chunk_size, CACHE_SIZE);
-    if(!this->id_dense_array) exit(EXIT_FAILURE);
+static void default_chunk_free(void* memory, const size_t size, void* user_data) {
+    (void)size;
+    (void)user_data;
+#if defined(_WIN32)
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
 
-    this->component_field_arrays = malloc(sizeof(void**) * number_of_all_components);
-    if(!this->component_field_arrays) exit(EXIT_FAILURE);
+void chunk_pool_init(ChunkPool* this, const ChunkAllocator* allocator) {
+    if (allocator) {
+        this->allocator = *allocator;
+    } else {
+        this->allocator.allocate = default_chunk_allocate;
+        this->allocator.free = default_chunk_free;
+        this->allocator.user_data = NULL;
+    }
+    this->buckets = NULL;
+    this->number_of_buckets = 0;
+    this->foreign_begin = NULL;
+    this->foreign_end = NULL;
+}
 
-    //initialize all to NULL
-    for (comp_id_t i = 0; i < number_of_all_components; i++) {
-        this->component_field_arrays[i] = NULL;
+//hands every released block back to the allocator
+void chunk_pool_trim(ChunkPool* this) {
+    for (uint32_t b = 0; b < this->number_of_buckets; b++) {
+        ChunkPoolBucket* bucket = &this->buckets[b];
+        for (uint32_t i = 0; i < bucket->number_of_blocks; i++) {
+            ECS_PROFILE_CHUNK_FREE(bucket->blocks[i], bucket->block_size);
+            this->allocator.free(bucket->blocks[i], bucket->block_size, this->allocator.user_data);
+        }
+        bucket->number_of_blocks = 0;
     }
+}
 
-    //only instantiate id indexes of active components
-    for (comp_id_t i = 0; i < number_of_archetype_components; i++) {
-        const comp_id_t current_comp_id = component_ids_of_archetype[i];
-        comp_size_t number_of_fields = all_components_data[current_comp_id].number_of_fields;
-        comp_size_t* field_sizes = all_components_data[current_comp_id].field_sizes;
+void chunk_pool_destroy(ChunkPool* this) {
+    chunk_pool_trim(this);
+    for (uint32_t b = 0; b < this->number_of_buckets; b++) {
+        free(this->buckets[b].blocks);
+    }
+    free(this->buckets);
+    this->buckets = NULL;
+    this->number_of_buckets = 0;
+}
 
-        this->component_field_arrays[current_comp_id] = malloc(sizeof(void*) * number_of_fields);
-        if(!this->component_field_arrays[current_comp_id]) exit(EXIT_FAILURE);
+//reuses a released block of the same size, only misses reach the allocator
+void* chunk_pool_acquire(ChunkPool* this, const size_t block_size) {
+    for (uint32_t b = 0; b < this->number_of_buckets; b++) {
+        ChunkPoolBucket* bucket = &this->buckets[b];
+        if (bucket->block_size == block_size && bucket->number_of_blocks > 0) {
+            return bucket->blocks[--bucket->number_of_blocks];
+        }
+    }
+    void* block = this->allocator.allocate(block_size, CACHE_SIZE, this->allocator.user_data);
+    if(!block) exit(EXIT_FAILURE);
+    ECS_PROFILE_CHUNK_ALLOCATE(block, block_size);
+    return block;
+}
 
-        for (comp_size_t j=0; j<number_of_fields; j++) {
-            this->component_field_arrays[current_comp_id][j] = _aligned_malloc(field_sizes[j] * chunk_size, CACHE_SIZE);
-            if(!this->component_field_arrays[current_comp_id][j]) exit(EXIT_FAILURE);
+void chunk_pool_release(ChunkPool* this, void* block, const size_t block_size) {
+    if ((const uint8_t*)block >= this->foreign_begin && (const uint8_t*)block < this->foreign_end) {
+        return;
+    }
+    ChunkPoolBucket* bucket = NULL;
+    for (uint32_t b = 0; b < this->number_of_buckets; b++) {
+        if (this->buckets[b].block_size == block_size) {
+            bucket = &this->buckets[b];
+            break;
         }
     }
+    if (!bucket) {
+        this->buckets = realloc(this->buckets, sizeof(ChunkPoolBucket) * (this->number_of_buckets + 1));
+        if(!this->buckets) exit(EXIT_FAILURE);
+        bucket = &this->buckets[this->number_of_buckets++];
+        bucket->blocks = NULL;
+        bucket->block_size = block_size;
+        bucket->number_of_blocks = 0;
+        bucket->capacity = 0;
+    }
+    if (bucket->number_of_blocks == bucket->capacity) {
+        bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 4;
+        bucket->blocks = realloc(bucket->blocks, sizeof(void*) * bucket->capacity);
+        if(!bucket->blocks) exit(EXIT_FAILURE);
+    }
+    bucket->blocks[bucket->number_of_blocks++] = block;
 }
 
-void archetype_data_chunk_destroy(ArchetypeDataChunk* chunk, const ComponentData* all_components_data, comp_id_t number_of_all_components) {
-    _aligned_free(chunk->id_dense_array);
 
-    for (comp_id_t i = 0; i < number_of_all_components; i++) {
-        if (chunk->component_field_arrays[i] != NULL) {
-            comp_size_t number_of_fields = all_components_data[i].number_of_fields;
-            for (comp_size_t j = 0; j < number_of_fields; j++) {
-                _aligned_free(chunk->component_field_arrays[i][j]);
-            }
-            free(chunk->component_field_arrays[i]);
+//ArchetypeDataChunk Functions
+#define ALIGN_UP(size, alignment) (((size) + (alignment) - 1) / (alignment) * (alignment))
+
+//the block starts with the column table and the column ticks, followed by the id array and every
+//field array on its own cache line. Without a chunk only the block size is computed.
+static size_t archetype_data_chunk_carve(ArchetypeDataChunk* this, uint8_t* block, const Archetype* archetype) {
+    size_t offset = ALIGN_UP((sizeof(void*) + sizeof(uint32_t)) * archetype->number_of_columns, CACHE_SIZE);
+    if (this) {
+        this->block = block;
+        this->columns = (void**)block;
+        this->column_ticks = (uint32_t*)(block + sizeof(void*) * archetype->number_of_columns);
+        this->id_dense_array = (id_t*)(block + offset);
+    }
+    offset += ALIGN_UP(sizeof(id_t) * archetype->chunk_size, CACHE_SIZE);
+
+    for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+        if (this) {
+            this->columns[column] = block + offset;
         }
+        offset += ALIGN_UP((size_t)archetype->column_sizes[column] * archetype->chunk_size, CACHE_SIZE);
     }
-    free(chunk->component_field_arrays);
+    return offset;
+}
+
+//an empty chunk in a block of chunk_block_size bytes
+static void archetype_data_chunk_init_block(ArchetypeDataChunk* this, const Archetype* archetype, uint8_t* block) {
+    this->dense_arrays_length = 0;
+    this->structure_tick = 0;
+    this->bounds_tick = 0;
+    this->key_min = UINT64_MAX;
+    this->key_max = 0;
+    archetype_data_chunk_carve(this, block, archetype);
+    memset(this->column_ticks, 0, sizeof(uint32_t) * archetype->number_of_columns);
+}
+
+void archetype_data_chunk_init(ArchetypeDataChunk* this, const Archetype* archetype, ChunkPool* chunk_pool) {
+    archetype_data_chunk_init_block(this, archetype, chunk_pool_acquire(chunk_pool, archetype->chunk_block_size));
+}
+
+void archetype_data_chunk_destroy(ArchetypeDataChunk* chunk, const Archetype* archetype, ChunkPool* chunk_pool) {
+    chunk_pool_release(chunk_pool, chunk->block, archetype->chunk_block_size);
+    chunk->block = NULL;
 }
 
 
 //Archetype Functions
+static uint32_t row_copy_class(const size_t field_size) {
+    for (uint32_t k = 0; k + 1 < ROW_COPY_CLASSES; k++) {
+        if (field_size == (size_t)1 << k) {
+            return k;
+        }
+    }
+    return ROW_COPY_CLASSES - 1;
+}
+
+//a counting sort of the columns by size class
+static void archetype_build_copy_plan(Archetype* this) {
+    this->copy_plan = malloc(sizeof(uint32_t) * this->number_of_columns);
+    if(!this->copy_plan && this->number_of_columns) exit(EXIT_FAILURE);
+
+    memset(this->copy_plan_class_begin, 0, sizeof(this->copy_plan_class_begin));
+    for (uint32_t column = 0; column < this->number_of_columns; column++) {
+        this->copy_plan_class_begin[row_copy_class(this->column_sizes[column]) + 1]++;
+    }
+    for (uint32_t k = 0; k < ROW_COPY_CLASSES; k++) {
+        this->copy_plan_class_begin[k + 1] += this->copy_plan_class_begin[k];
+    }
+    uint32_t next[ROW_COPY_CLASSES];
+    memcpy(next, this->copy_plan_class_begin, sizeof(next));
+    for (uint32_t column = 0; column < this->number_of_columns; column++) {
+        this->copy_plan[next[row_copy_class(this->column_sizes[column])]++] = column;
+    }
+}
+
+//one loop per size class with a constant size, so the compiler turns each memcpy into plain or vector moves
+#define ROW_COPY_COLUMNS(class, size)                                                                   \
+    for (uint32_t i = archetype->copy_plan_class_begin[class]; i < archetype->copy_plan_class_begin[(class) + 1]; i++) {\
+        const uint32_t column = archetype->copy_plan[i];                                                \
+        memcpy(                                                                                         \
+            (uint8_t*)target->columns[column] + (size_t)target_row * (size),                            \
+            (const uint8_t*)source->columns[column] + (size_t)source_row * (size),                      \
+            (size));                                                                                    \
+    }
+
+//copies every field of a row, the chunks may be the same but the rows must differ
+void archetype_copy_row(
+    const Archetype* archetype,
+    const ArchetypeDataChunk* target,
+    const chunk_size_t target_row,
+    const ArchetypeDataChunk* source,
+    const chunk_size_t source_row) {
+
+    ROW_COPY_COLUMNS(0, 1)
+    ROW_COPY_COLUMNS(1, 2)
+    ROW_COPY_COLUMNS(2, 4)
+    ROW_COPY_COLUMNS(3, 8)
+    ROW_COPY_COLUMNS(4, 16)
+    ROW_COPY_COLUMNS(5, 32)
+    ROW_COPY_COLUMNS(ROW_COPY_CLASSES - 1, archetype->column_sizes[column])
+}
+
+#define ROW_MOVE_COLUMNS(class, size)                                                                   \
+    for (uint32_t i = archetype->copy_plan_class_begin[class]; i < archetype->copy_plan_class_begin[(class) + 1]; i++) {\
+        const uint32_t column = archetype->copy_plan[i];                                                \
+        uint8_t* field_array = chunk->columns[column];                                                  \
+        for (id_t m = 0; m < number_of_moves; m++) {                                                    \
+            memcpy(field_array + (size_t)destinations[m] * (size), field_array + (size_t)sources[m] * (size), (size));\
+        }                                                                                               \
+    }
+
+//moves rows inside one chunk in the given order, one field array at a time
+void archetype_move_rows(
+    const Archetype* archetype,
+    const ArchetypeDataChunk* chunk,
+    const id_t* destinations,
+    const id_t* sources,
+    const id_t number_of_moves) {
+
+    ROW_MOVE_COLUMNS(0, 1)
+    ROW_MOVE_COLUMNS(1, 2)
+    ROW_MOVE_COLUMNS(2, 4)
+    ROW_MOVE_COLUMNS(3, 8)
+    ROW_MOVE_COLUMNS(4, 16)
+    ROW_MOVE_COLUMNS(5, 32)
+    ROW_MOVE_COLUMNS(ROW_COPY_CLASSES - 1, archetype->column_sizes[column])
+}
+
+//a single field with the copy size of its class, for copies between different archetypes
+static void row_copy_field(void* target, const void* source, const size_t field_size) {
+    switch (field_size) {
+        case 1: memcpy(target, source, 1); break;
+        case 2: memcpy(target, source, 2); break;
+        case 4: memcpy(target, source, 4); break;
+        case 8: memcpy(target, source, 8); break;
+        case 16: memcpy(target, source, 16); break;
+        case 32: memcpy(target, source, 32); break;
+        default: memcpy(target, source, field_size); break;
+    }
+}
+
+//the most rows whose block, padding included, stays within the budget but at least one
+chunk_size_t archetype_chunk_size_for_budget(Archetype* archetype, const size_t chunk_byte_budget) {
+    size_t row_size = sizeof(id_t);
+    for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+        row_size += archetype->column_sizes[column];
+    }
+
+    archetype->chunk_size = chunk_byte_budget / row_size ? chunk_byte_budget / row_size : 1;
+    size_t block_size = archetype_data_chunk_carve(NULL, NULL, archetype);
+    while (block_size > chunk_byte_budget && archetype->chunk_size > 1) {
+        const size_t excess_rows = (block_size - chunk_byte_budget + row_size - 1) / row_size;
+        archetype->chunk_size = excess_rows < archetype->chunk_size ? archetype->chunk_size - excess_rows : 1;
+        block_size = archetype_data_chunk_carve(NULL, NULL, archetype);
+    }
+    return archetype->chunk_size;
+}
+
 void archetype_init(
     Archetype* this,
     const arch_id_t archetype_id,
-    const comp_id_t number_of_all_components,
     const ComponentData* all_components_data,
     const comp_id_t number_of_archetype_components,
     const comp_id_t* component_ids_of_archetype,
     const size_t chunk_size,
-    const size_t number_of_chunks) {
+    const size_t chunk_byte_budget,
+    const size_t number_of_chunks,
+    ChunkPool* chunk_pool) {
 
     this->number_of_chunks = number_of_chunks;
+    this->chunks_capacity = number_of_chunks ? number_of_chunks : 1;
     this->chunk_size = chunk_size;
     this->number_of_components = number_of_archetype_components;
     this->archetype_id = archetype_id;
-
-    this->chunks = malloc(sizeof(ArchetypeDataChunk) * number_of_chunks);
-    if(!this->chunks) exit(EXIT_FAILURE);
-
-    for (size_t i = 0; i < number_of_chunks; i++) {
-        archetype_data_chunk_init(
-            &this->chunks[i],
-            all_components_data,
-            number_of_all_components,
-            number_of_archetype_components,
-            component_ids_of_archetype,
-            chunk_size);
-    }
+    this->edges = NULL;
+    this->number_of_edges = 0;
+    this->sort_key = UINT32_MAX;
+    this->sort_tick = 0;
 
     this->components = malloc(sizeof(comp_id_t) * number_of_archetype_components);
     if(!this->components) exit(EXIT_FAILURE);
@@ -125,438 +529,4021 @@ void archetype_init(
     for (int i = 0; i < number_of_archetype_components; i++) {
         this->components[i] = component_ids_of_archetype[i];
     }
+    component_mask_init(&this->mask, component_ids_of_archetype, number_of_archetype_components);
+
+    this->component_columns = malloc(sizeof(uint32_t) * number_of_archetype_components);
+    if(!this->component_columns && number_of_archetype_components) exit(EXIT_FAILURE);
+    this->number_of_columns = 0;
+    for (comp_id_t c = 0; c < number_of_archetype_components; c++) {
+        this->component_columns[c] = this->number_of_columns;
+        this->number_of_columns += all_components_data[component_ids_of_archetype[c]].number_of_fields;
+    }
+    this->column_sizes = malloc(sizeof(comp_size_t) * this->number_of_columns);
+    if(!this->column_sizes && this->number_of_columns) exit(EXIT_FAILURE);
+    for (comp_id_t c = 0; c < number_of_archetype_components; c++) {
+        const ComponentData* component_data = &all_components_data[component_ids_of_archetype[c]];
+        for (comp_size_t f = 0; f < component_data->number_of_fields; f++) {
+            this->column_sizes[this->component_columns[c] + f] = component_data->field_sizes[f];
+        }
+    }
+
+    archetype_build_copy_plan(this);
+
+    if (chunk_byte_budget) {
+        this->chunk_size = archetype_chunk_size_for_budget(this, chunk_byte_budget);
+    }
+    //every chunk of the archetype has the same layout
+    this->chunk_block_size = archetype_data_chunk_carve(NULL, NULL, this);
+
+    this->chunks = malloc(sizeof(ArchetypeDataChunk) * this->chunks_capacity);
+    if(!this->chunks) exit(EXIT_FAILURE);
+    this->free_chunks = malloc(sizeof(chunks_length_t) * this->chunks_capacity);
+    if(!this->free_chunks) exit(EXIT_FAILURE);
+
+    for (size_t i = 0; i < number_of_chunks; i++) {
+        archetype_data_chunk_init(&this->chunks[i], this, chunk_pool);
+    }
+
+    //all chunks start empty, the first one ends up on top of the stack
+    this->number_of_free_chunks = number_of_chunks;
+    for (size_t i = 0; i < number_of_chunks; i++) {
+        this->free_chunks[i] = number_of_chunks - 1 - i;
+    }
 }
 
-void archetype_destroy(Archetype* archetype, const ComponentData* all_components_data, comp_id_t number_of_all_components) {
+void archetype_destroy(Archetype* archetype, ChunkPool* chunk_pool) {
     for (chunks_length_t i = 0; i < archetype->number_of_chunks; i++) {
-        archetype_data_chunk_destroy(&archetype->chunks[i], all_components_data, number_of_all_components);
+        archetype_data_chunk_destroy(&archetype->chunks[i], archetype, chunk_pool);
     }
     free(archetype->chunks);
+    free(archetype->free_chunks);
     free(archetype->components);
+    free(archetype->component_columns);
+    free(archetype->column_sizes);
+    free(archetype->copy_plan);
+    free(archetype->edges);
+}
+
+//the chunk array grows geometrically
+void archetype_reserve_chunks(Archetype* archetype, const chunks_length_t number_of_chunks) {
+    if (number_of_chunks <= archetype->chunks_capacity) {
+        return;
+    }
+    while (archetype->chunks_capacity < number_of_chunks) {
+        archetype->chunks_capacity *= 2;
+    }
+    archetype->chunks = realloc(archetype->chunks, sizeof(ArchetypeDataChunk) * archetype->chunks_capacity);
+    if(!archetype->chunks) exit(EXIT_FAILURE);
+    archetype->free_chunks = realloc(archetype->free_chunks, sizeof(chunks_length_t) * archetype->chunks_capacity);
+    if(!archetype->free_chunks) exit(EXIT_FAILURE);
+}
+
+//appends an empty chunk and pushes it on the free chunk stack
+chunks_length_t archetype_add_chunk(Archetype* archetype, ChunkPool* chunk_pool) {
+    archetype_reserve_chunks(archetype, archetype->number_of_chunks + 1);
+
+    const chunks_length_t chunk_index = archetype->number_of_chunks++;
+    archetype_data_chunk_init(&archetype->chunks[chunk_index], archetype, chunk_pool);
+
+    archetype->free_chunks[archetype->number_of_free_chunks++] = chunk_index;
+    return chunk_index;
 }
 
 void archetype_add_entity(
     Archetype* archetype,
     const id_t entity_id,
-    const comp_id_t number_of_all_components,
-    const ComponentData* all_components_data,
+    ChunkPool* chunk_pool,
     id_t* id_dense_array_index,
     chunk_size_t* chunk_index)
 {
-    for (size_t i = 0; i < archetype->number_of_chunks; i++) {
-        if (archetype->chunks[i].dense_arrays_length < archetype->chunk_size) {
-            archetype->chunks[i].id_dense_array[archetype->chunks[i].dense_arrays_length] = entity_id;
-            *id_dense_array_index = archetype->chunks[i].dense_arrays_length++;
-            *chunk_index = i;
-            return;
+    //the top of the free chunk stack always has space
+    if (archetype->number_of_free_chunks == 0) {
+        archetype_add_chunk(archetype, chunk_pool);
+    }
+
+    const chunks_length_t i = archetype->free_chunks[archetype->number_of_free_chunks - 1];
+    ArchetypeDataChunk* chunk = &archetype->chunks[i];
+    chunk->id_dense_array[chunk->dense_arrays_length] = entity_id;
+    *id_dense_array_index = chunk->dense_arrays_length++;
+    *chunk_index = i;
+
+    if (chunk->dense_arrays_length == archetype->chunk_size) {
+        archetype->number_of_free_chunks--;
+    }
+}
+
+//position of a component the archetype has in its sorted component list
+comp_id_t archetype_component_index(const Archetype* archetype, const comp_id_t component_id) {
+    comp_id_t low = 0;
+    comp_id_t high = archetype->number_of_components;
+    while (low < high) {
+        const comp_id_t middle = low + (high - low) / 2;
+        if (archetype->components[middle] < component_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
     }
-    //if no space inside any chunk we allocate a new and recall the function
-    archetype->number_of_chunks++;
-    archetype->chunks = realloc(archetype->chunks, sizeof(ArchetypeDataChunk) * archetype->number_of_chunks);
-    if(!archetype->chunks) exit(EXIT_FAILURE);
+    return low;
+}
+
+//the field arrays of one of the archetype's components within a chunk
+void** archetype_chunk_component_fields(const Archetype* archetype, const ArchetypeDataChunk* chunk, const comp_id_t component_id) {
+    return &chunk->columns[archetype->component_columns[archetype_component_index(archetype, component_id)]];
+}
+
+//columns of a component in the archetype's column order, see archetype_chunk_component_fields
+uint32_t archetype_component_number_of_columns(const Archetype* archetype, const comp_id_t component_index) {
+    const uint32_t end = component_index + 1 < archetype->number_of_components
+        ? archetype->component_columns[component_index + 1]
+        : archetype->number_of_columns;
+    return end - archetype->component_columns[component_index];
+}
+
+void archetype_chunk_mark_component(const Archetype* archetype, ArchetypeDataChunk* chunk, const comp_id_t component_id, const uint32_t tick) {
+    const comp_id_t component_index = archetype_component_index(archetype, component_id);
+    const uint32_t first_column = archetype->component_columns[component_index];
+    const uint32_t number_of_columns = archetype_component_number_of_columns(archetype, component_index);
+    for (uint32_t column = first_column; column < first_column + number_of_columns; column++) {
+        chunk->column_ticks[column] = tick;
+    }
+}
+
+//a structural change or a write to one of the component's columns after tick
+bool archetype_chunk_component_changed(const Archetype* archetype, const ArchetypeDataChunk* chunk, const comp_id_t component_id, const uint32_t tick) {
+    if (chunk->structure_tick > tick) {
+        return true;
+    }
+    const comp_id_t component_index = archetype_component_index(archetype, component_id);
+    const uint32_t first_column = archetype->component_columns[component_index];
+    const uint32_t number_of_columns = archetype_component_number_of_columns(archetype, component_index);
+    for (uint32_t column = first_column; column < first_column + number_of_columns; column++) {
+        if (chunk->column_ticks[column] > tick) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//drops the last rows of a chunk, a chunk that was full gets space again
+void archetype_pop_rows(Archetype* archetype, const chunks_length_t chunk_index, const chunk_size_t number_of_rows) {
+    ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+    if (chunk->dense_arrays_length == archetype->chunk_size && number_of_rows > 0) {
+        archetype->free_chunks[archetype->number_of_free_chunks++] = chunk_index;
+    }
+    chunk->dense_arrays_length -= number_of_rows;
+}
+
+void archetype_pop_row(Archetype* archetype, const chunks_length_t chunk_index) {
+    archetype_pop_rows(archetype, chunk_index, 1);
+}
+
+//empties every chunk, they all go back on the free chunk stack
+void archetype_clear(Archetype* archetype) {
+    for (chunks_length_t i = 0; i < archetype->number_of_chunks; i++) {
+        archetype->chunks[i].dense_arrays_length = 0;
+        archetype->free_chunks[i] = archetype->number_of_chunks - 1 - i;
+    }
+    archetype->number_of_free_chunks = archetype->number_of_chunks;
+}
+
+//rebuilds the free chunk stack from the chunk lengths, the first chunk with space ends up on top
+void archetype_rebuild_free_chunks(Archetype* archetype) {
+    archetype->number_of_free_chunks = 0;
+    for (chunks_length_t i = archetype->number_of_chunks; i > 0; i--) {
+        if (archetype->chunks[i - 1].dense_arrays_length < archetype->chunk_size) {
+            archetype->free_chunks[archetype->number_of_free_chunks++] = i - 1;
+        }
+    }
+}
 
-    archetype_data_chunk_init(
-            &archetype->chunks[archetype->number_of_chunks - 1],
-            all_components_data,
-            number_of_all_components,
-            archetype->number_of_components,
-            archetype->components,
-            archetype->chunk_size);
+//returns the cached transitions for one component, appending an unresolved edge if there is none
+ArchetypeEdge* archetype_get_edge(Archetype* archetype, const comp_id_t component_id) {
+    for (comp_id_t e = 0; e < archetype->number_of_edges; e++) {
+        if (archetype->edges[e].component == component_id) {
+            return &archetype->edges[e];
+        }
+    }
+    archetype->edges = realloc(archetype->edges, sizeof(ArchetypeEdge) * (archetype->number_of_edges + 1));
+    if(!archetype->edges) exit(EXIT_FAILURE);
 
-    archetype->chunks[archetype->number_of_chunks - 1].id_dense_array[0] = entity_id;
-    archetype->chunks[archetype->number_of_chunks - 1].dense_arrays_length++;
-    *id_dense_array_index = 0;
-    *chunk_index = archetype->number_of_chunks - 1;
+    ArchetypeEdge* edge = &archetype->edges[archetype->number_of_edges++];
+    edge->component = component_id;
+    edge->add = ARCH_ID_INVALID;
+    edge->remove = ARCH_ID_INVALID;
+    return edge;
 }
 
 
 //SparseArrayChunk Functions
 void sparse_array_chunk_init(SparseArrayChunk* this, chunk_size_t size) {
-    this->archetypes = malloc(sizeof(arch_id_t) * size);
-    if(!this->archetypes) exit(EXIT_FAILURE);
-    this->chunk_indexes = malloc(sizeof(chunks_length_t) * size);
-    if(!this->chunk_indexes) exit(EXIT_FAILURE);
-    this->dense_id_array_indexes = malloc(sizeof(id_t) * size);
-    if(!this->dense_id_array_indexes) exit(EXIT_FAILURE);
+    this->entries = malloc(sizeof(SparseEntry) * size);
+    if(!this->entries) exit(EXIT_FAILURE);
+    //no entity lives in the chunk yet
+    for (chunk_size_t i = 0; i < size; i++) {
+        this->entries[i].dense_id_array_index = 0;
+        this->entries[i].chunk_index = 0;
+        this->entries[i].archetype = ARCH_ID_INVALID;
+        this->entries[i].generation = 0;
+    }
 }
 
 void sparse_array_chunk_destroy(SparseArrayChunk* this) {
-    free(this->archetypes);
-    free(this->chunk_indexes);
-    free(this->dense_id_array_indexes);
+    free(this->entries);
 }
 
 
-//World Functions
-World world_create(
-    const chunk_size_t dense_array_chunk_size,
-    const chunk_size_t sparse_array_chunk_size,
-    const chunks_length_t starting_sparse_array_chunks
-) {
-    World this = {
-        .archetypes = NULL,
-        .id_stack_ids = NULL,
-        .id_stack_capacity = sparse_array_chunk_size,
-        .id_stack_top_index = 0,
-        .component_ids = NULL,
-        .all_components_data = NULL,
-        .sparse_array_chunks = NULL,
-        .sparse_array_chunk_size = sparse_array_chunk_size,
-        .sparse_array_number_of_chunks = starting_sparse_array_chunks,
-        .dense_array_chunk_size = dense_array_chunk_size,
-        .number_of_archetypes = 0,
-        .number_of_components = 0
-    };
+//Query Functions
+static void query_reserve_chunks(Query* this, const chunks_length_t number_of_chunks) {
+    if (number_of_chunks <= this->chunk_capacity) {
+        return;
+    }
+    chunks_length_t capacity = this->chunk_capacity ? this->chunk_capacity : 4;
+    while (capacity < number_of_chunks) {
+        capacity *= 2;
+    }
+
+    this->chunk_archetypes = realloc(this->chunk_archetypes, sizeof(arch_id_t) * capacity);
+    if(!this->chunk_archetypes) exit(EXIT_FAILURE);
+    this->chunk_indexes = realloc(this->chunk_indexes, sizeof(chunks_length_t) * capacity);
+    if(!this->chunk_indexes) exit(EXIT_FAILURE);
+    this->column_table = realloc(this->column_table, sizeof(void**) * capacity * this->number_of_components);
+    if(!this->column_table && this->number_of_components) exit(EXIT_FAILURE);
+    this->iterator.component_field_arrays = realloc(this->iterator.component_field_arrays, sizeof(void***) * capacity);
+    if(!this->iterator.component_field_arrays) exit(EXIT_FAILURE);
+    this->iterator.chunk_lengths = realloc(this->iterator.chunk_lengths, sizeof(chunk_size_t) * capacity);
+    if(!this->iterator.chunk_lengths) exit(EXIT_FAILURE);
 
-    this.id_stack_ids = malloc(sizeof(id_t) * this.id_stack_capacity);
-    if(!this.id_stack_ids) exit(EXIT_FAILURE);
-    for (id_t i = 0; i < this.id_stack_capacity; i++) {
-        this.id_stack_ids[i] = i;
+    //the column table may have moved
+    for (chunks_length_t c = 0; c < this->iterator.number_of_chunks; c++) {
+        this->iterator.component_field_arrays[c] = &this->column_table[c * this->number_of_components];
     }
+    this->chunk_capacity = capacity;
+}
 
-    this.sparse_array_chunks = malloc(sizeof(SparseArrayChunk) * starting_sparse_array_chunks);
-    if(!this.sparse_array_chunks) exit(EXIT_FAILURE);
+void query_add_chunk(Query* this, const Archetype* archetype, const chunks_length_t chunk_index) {
+    query_reserve_chunks(this, this->iterator.number_of_chunks + 1);
 
-    for (chunks_length_t c=0; c< starting_sparse_array_chunks; c++) {
-        sparse_array_chunk_init(&this.sparse_array_chunks[c], this.sparse_array_chunk_size);
+    const chunks_length_t c = this->iterator.number_of_chunks++;
+    const ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+    void*** columns = &this->column_table[c * this->number_of_components];
+    for (comp_id_t co = 0; co < this->number_of_components; co++) {
+        columns[co] = component_mask_has(&archetype->mask, this->components[co])
+            ? archetype_chunk_component_fields(archetype, chunk, this->components[co])
+            : NULL;
     }
 
-    return this;
+    this->chunk_archetypes[c] = archetype->archetype_id;
+    this->chunk_indexes[c] = chunk_index;
+    this->iterator.component_field_arrays[c] = columns;
+    this->iterator.chunk_lengths[c] = chunk->dense_arrays_length;
 }
 
-void world_destroy(World* world) {
-    for (arch_id_t i = 0; i < world->number_of_archetypes; i++) {
-        archetype_destroy(&world->archetypes[i], world->all_components_data, world->number_of_components);
-    }
-    free(world->archetypes);
+void query_add_archetype(Query* this, const Archetype* archetype) {
+    this->archetypes = realloc(this->archetypes, sizeof(arch_id_t) * (this->number_of_archetypes + 1));
+    if(!this->archetypes) exit(EXIT_FAILURE);
+    this->archetypes[this->number_of_archetypes++] = archetype->archetype_id;
 
-    for (comp_id_t i = 0; i < world->number_of_components; i++) {
-        component_data_destroy(&world->all_components_data[i]);
+    query_reserve_chunks(this, this->iterator.number_of_chunks + archetype->number_of_chunks);
+    for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+        query_add_chunk(this, archetype, ch);
     }
-    free(world->all_components_data);
-    free(world->component_ids);
+}
 
-    for (chunks_length_t i = 0; i < world->sparse_array_number_of_chunks; i++) {
-        sparse_array_chunk_destroy(&world->sparse_array_chunks[i]);
+//collects the chunks of every matched archetype again, needed once chunks were freed or renumbered
+void query_rebuild_chunks(Query* this, const Archetype* archetypes) {
+    this->iterator.number_of_chunks = 0;
+    for (arch_id_t a = 0; a < this->number_of_archetypes; a++) {
+        const Archetype* archetype = &archetypes[this->archetypes[a]];
+        query_reserve_chunks(this, this->iterator.number_of_chunks + archetype->number_of_chunks);
+        for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+            query_add_chunk(this, archetype, ch);
+        }
     }
-    free(world->sparse_array_chunks);
-
-    free(world->id_stack_ids);
 }
 
-static bool world_match_archetype(const World* world, comp_id_t number_of_components, const comp_id_t* components, arch_id_t* matched_arch_id) {
-    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
-        if (world->archetypes[a].number_of_components == number_of_components) {
-            bool matched = true;
-            for (comp_id_t c = 0; c < number_of_components; c++) {
-                if (world->archetypes[a].components[c] != components[c]) {
-                    matched = false;
-                    break;
-                }
-            }
-            if (matched) {
-                *matched_arch_id = a;
-                return true;
-            }
+bool query_has_archetype(const Query* this, const arch_id_t archetype_id) {
+    for (arch_id_t a = 0; a < this->number_of_archetypes; a++) {
+        if (this->archetypes[a] == archetype_id) {
+            return true;
         }
     }
     return false;
 }
 
-static arch_id_t world_add_archetype(World* world, const comp_id_t number_of_components, const comp_id_t* components) {
-    world->archetypes = realloc(world->archetypes, (world->number_of_archetypes + 1) * sizeof(Archetype));
-    if(!world->archetypes) exit(EXIT_FAILURE);
+void query_init(Query* this, const QueryDesc* desc) {
+    const comp_id_t number_of_components = query_desc_number_of_columns(desc);
+    this->number_of_components = number_of_components;
+    this->number_of_archetypes = 0;
+    this->archetypes = NULL;
+    this->chunk_archetypes = NULL;
+    this->chunk_indexes = NULL;
+    this->column_table = NULL;
+    this->chunk_capacity = 0;
+    this->iterator.component_field_arrays = NULL;
+    this->iterator.chunk_lengths = NULL;
+    this->iterator.number_of_chunks = 0;
+    this->number_of_iterations = 0;
+    this->rows_iterated = 0;
 
-    size_t number_of_chunks = 1;
-
-    archetype_init(
-        &world->archetypes[world->number_of_archetypes],
-        world->number_of_archetypes,
-        world->number_of_components,
-        world->all_components_data,
-        number_of_components,
-        components,
-        world->dense_array_chunk_size,
-        number_of_chunks);
+    this->components = malloc(sizeof(comp_id_t) * number_of_components);
+    if(!this->components && number_of_components) exit(EXIT_FAILURE);
+    query_desc_columns(desc, this->components);
+    query_filter_init(&this->filter, desc);
 
-    return world->number_of_archetypes++;
+    this->number_of_written = desc->number_of_written;
+    this->written = malloc(sizeof(comp_id_t) * desc->number_of_written);
+    if(!this->written && desc->number_of_written) exit(EXIT_FAILURE);
+    for (comp_id_t i = 0; i < desc->number_of_written; i++) {
+        this->written[i] = desc->written[i];
+    }
 }
 
-comp_id_t world_add_component_type(World* world, const comp_size_t* field_sizes, const comp_size_t number_of_fields) {
+void query_destroy(Query* this) {
+    free(this->components);
+    free(this->written);
+    free(this->archetypes);
+    free(this->chunk_archetypes);
+    free(this->chunk_indexes);
+    free(this->column_table);
+    free(this->iterator.component_field_arrays);
+    free(this->iterator.chunk_lengths);
+}
+
+
+//Snapshot Mapping Functions
+//maps a whole file copy-on-write, writes to the pages never reach the file
+static void* snapshot_map(const char* path, size_t* size) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return NULL;
+    }
+    //the view keeps the mapping object alive
+    void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = (size_t)file_size.QuadPart;
+    return view;
+#else
+    const int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(file);
+        return NULL;
+    }
+    void* view = mmap(NULL, (size_t)file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (view == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)file_stat.st_size;
+    return view;
+#endif
+}
+
+static void snapshot_unmap(void* view, const size_t size) {
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+}
+
+
+//World Functions
+World world_create_with_config(const WorldConfig* config) {
+    //sparse chunks are rounded up to a power of two
+    uint32_t sparse_array_chunk_shift = 0;
+    while (((chunk_size_t)1 << sparse_array_chunk_shift) < config->sparse_array_chunk_size) {
+        sparse_array_chunk_shift++;
+    }
+
+    //the index range defaults to everything from the first index on
+    const id_t index_space = ENTITY_INDEX_MASK + 1;
+    assert(config->first_entity_index < index_space);
+    const id_t number_of_entity_indexes = config->number_of_entity_indexes ? config->number_of_entity_indexes : index_space - config->first_entity_index;
+    assert(number_of_entity_indexes <= index_space - config->first_entity_index);
+
+    World this = {
+        .archetypes = NULL,
+        .id_stack_ids = NULL,
+        .id_stack_capacity = 0,
+        .id_stack_top_index = 0,
+        .next_entity_slot = 0,
+        .component_ids = NULL,
+        .all_components_data = NULL,
+        .sparse_components = NULL,
+        .number_of_sparse_components = 0,
+        .queries = NULL,
+        .sort_keys = NULL,
+        .number_of_sort_keys = 0,
+        .archetype_lookup = NULL,
+        .archetype_lookup_capacity = 0,
+        .sparse_array_chunks = NULL,
+        .sparse_array_chunk_size = (chunk_size_t)1 << sparse_array_chunk_shift,
+        .sparse_array_chunk_shift = sparse_array_chunk_shift,
+        .starting_sparse_array_chunks = config->starting_sparse_array_chunks,
+        .sparse_array_number_of_chunks = 0,
+        .sparse_array_chunks_capacity = config->starting_sparse_array_chunks ? config->starting_sparse_array_chunks : 1,
+        .first_entity_index = config->first_entity_index,
+        .number_of_entity_indexes = number_of_entity_indexes,
+        .dense_array_chunk_size = config->dense_array_chunk_size,
+        .chunk_byte_budget = config->chunk_byte_budget,
+        .number_of_archetypes = 0,
+        .number_of_components = 0,
+        .number_of_queries = 0,
+        .compact_cursor = 0,
+        .change_tick = 1,
+        .mapping = NULL,
+        .mapping_size = 0
+    };
+    chunk_pool_init(&this.chunk_pool, config->chunk_allocator);
+
+    //starting_sparse_array_chunks only sizes the directory, the pages come with the first ids in them
+    this.sparse_array_chunks = malloc(sizeof(SparseArrayChunk) * this.sparse_array_chunks_capacity);
+    if(!this.sparse_array_chunks) exit(EXIT_FAILURE);
+
+    return this;
+}
+
+World world_create(
+    const chunk_size_t dense_array_chunk_size,
+    const chunk_size_t sparse_array_chunk_size,
+    const chunks_length_t starting_sparse_array_chunks
+) {
+    const WorldConfig config = {
+        .dense_array_chunk_size = dense_array_chunk_size,
+        .sparse_array_chunk_size = sparse_array_chunk_size,
+        .starting_sparse_array_chunks = starting_sparse_array_chunks,
+        .chunk_byte_budget = 0,
+        .chunk_allocator = NULL,
+        .first_entity_index = 0,
+        .number_of_entity_indexes = 0
+    };
+    return world_create_with_config(&config);
+}
+
+void world_destroy(World* world) {
+    for (query_id_t i = 0; i < world->number_of_queries; i++) {
+        query_destroy(&world->queries[i]);
+    }
+    free(world->queries);
+    free(world->sort_keys);
+
+    for (arch_id_t i = 0; i < world->number_of_archetypes; i++) {
+        archetype_destroy(&world->archetypes[i], &world->chunk_pool);
+    }
+    free(world->archetypes);
+    chunk_pool_destroy(&world->chunk_pool);
+    free(world->archetype_lookup);
+
+    for (comp_id_t i = 0; i < world->number_of_components; i++) {
+        component_data_destroy(&world->all_components_data[i]);
+    }
+    free(world->all_components_data);
+    free(world->component_ids);
+    free(world->sparse_components);
+
+    for (chunks_length_t i = 0; i < world->sparse_array_number_of_chunks; i++) {
+        sparse_array_chunk_destroy(&world->sparse_array_chunks[i]);
+    }
+    free(world->sparse_array_chunks);
+
+    free(world->id_stack_ids);
+
+    //the mapped chunk blocks were dropped by the pool above
+    if (world->mapping) {
+        snapshot_unmap(world->mapping, world->mapping_size);
+        world->mapping = NULL;
+    }
+}
+
+static bool world_match_archetype(const World* world, const ComponentMask* mask, arch_id_t* matched_arch_id) {
+    if (world->archetype_lookup_capacity == 0) {
+        return false;
+    }
+    const uint32_t slot_mask = world->archetype_lookup_capacity - 1;
+    for (uint32_t slot = component_mask_hash(mask) & slot_mask;; slot = (slot + 1) & slot_mask) {
+        const arch_id_t a = world->archetype_lookup[slot];
+        if (a == ARCH_ID_INVALID) {
+            return false;
+        }
+        if (component_mask_equals(&world->archetypes[a].mask, mask)) {
+            *matched_arch_id = a;
+            return true;
+        }
+    }
+}
+
+static void world_insert_archetype_lookup(World* world, const arch_id_t archetype_id) {
+    const uint32_t slot_mask = world->archetype_lookup_capacity - 1;
+    uint32_t slot = component_mask_hash(&world->archetypes[archetype_id].mask) & slot_mask;
+    while (world->archetype_lookup[slot] != ARCH_ID_INVALID) {
+        slot = (slot + 1) & slot_mask;
+    }
+    world->archetype_lookup[slot] = archetype_id;
+}
+
+//keeps the table at most half full so probe sequences stay short
+static void world_reserve_archetype_lookup(World* world, const uint32_t number_of_archetypes) {
+    if (number_of_archetypes * 2 <= world->archetype_lookup_capacity) {
+        return;
+    }
+    uint32_t capacity = world->archetype_lookup_capacity ? world->archetype_lookup_capacity : 16;
+    while (number_of_archetypes * 2 > capacity) {
+        capacity *= 2;
+    }
+
+    free(world->archetype_lookup);
+    world->archetype_lookup = malloc(sizeof(arch_id_t) * capacity);
+    if(!world->archetype_lookup) exit(EXIT_FAILURE);
+    world->archetype_lookup_capacity = capacity;
+    for (uint32_t i = 0; i < capacity; i++) {
+        world->archetype_lookup[i] = ARCH_ID_INVALID;
+    }
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        world_insert_archetype_lookup(world, a);
+    }
+}
+
+static arch_id_t world_add_archetype(
+    World* world,
+    const comp_id_t number_of_components,
+    const comp_id_t* components,
+    const size_t number_of_chunks)
+{
+    //ARCH_ID_INVALID marks empty lookup slots so it can never be a real archetype,
+    //running out of archetype ids is fatal like running out of memory
+    if(world->number_of_archetypes >= ARCH_ID_INVALID) exit(EXIT_FAILURE);
+    world->archetypes = realloc(world->archetypes, (world->number_of_archetypes + 1) * sizeof(Archetype));
+    if(!world->archetypes) exit(EXIT_FAILURE);
+
+    archetype_init(
+        &world->archetypes[world->number_of_archetypes],
+        world->number_of_archetypes,
+        world->all_components_data,
+        number_of_components,
+        components,
+        world->dense_array_chunk_size,
+        world->chunk_byte_budget,
+        number_of_chunks,
+        &world->chunk_pool);
+
+    world_reserve_archetype_lookup(world, world->number_of_archetypes + 1);
+    world_insert_archetype_lookup(world, world->number_of_archetypes);
+
+    Archetype* archetype = &world->archetypes[world->number_of_archetypes];
+    for (uint32_t k = 0; k < world->number_of_sort_keys && archetype->sort_key == UINT32_MAX; k++) {
+        if (component_mask_has(&archetype->mask, world->sort_keys[k].component)) {
+            archetype->sort_key = k;
+        }
+    }
+    for (query_id_t q = 0; q < world->number_of_queries; q++) {
+        Query* query = &world->queries[q];
+        if (query_filter_matches(&query->filter, &archetype->mask)) {
+            query_add_archetype(query, archetype);
+        }
+    }
+
+    return world->number_of_archetypes++;
+}
+
+//archetypes store their components sorted, which the mask gives us for free
+static arch_id_t world_add_archetype_from_mask(World* world, const ComponentMask* mask) {
+    comp_id_t components[MAX_COMPONENTS];
+    uint32_t number_of_components = 0;
+    for (uint32_t c = 0; c < world->number_of_components; c++) {
+        if (component_mask_has(mask, c)) {
+            components[number_of_components++] = c;
+        }
+    }
+    return world_add_archetype(world, number_of_components, components, 1);
+}
+
+//keeps the cached queries in sync when archetype_add_entity had to allocate a chunk
+static void world_on_chunk_added(World* world, const arch_id_t archetype_id, const chunks_length_t chunk_index) {
+    for (query_id_t q = 0; q < world->number_of_queries; q++) {
+        if (query_has_archetype(&world->queries[q], archetype_id)) {
+            query_add_chunk(&world->queries[q], &world->archetypes[archetype_id], chunk_index);
+        }
+    }
+}
+
+//rows of the chunk were added, removed or moved
+static void world_touch_chunk(const World* world, Archetype* archetype, const chunks_length_t chunk_index) {
+    archetype->chunks[chunk_index].structure_tick = world->change_tick;
+}
+
+comp_id_t world_add_component_type_with_storage(
+    World* world,
+    const comp_size_t* field_sizes,
+    const comp_size_t number_of_fields,
+    const ComponentStorage storage)
+{
+    //keeps the component count itself from wrapping, also without asserts
+    if((uint32_t)world->number_of_components + 1 >= MAX_COMPONENTS) exit(EXIT_FAILURE);
     world->component_ids = realloc(
         world->component_ids,
         sizeof(comp_id_t) * (world->number_of_components + 1));
     if(!world->component_ids) exit(EXIT_FAILURE);
 
-    world->all_components_data = realloc(
-        world->all_components_data,
-        sizeof(ComponentData) * (world->number_of_components + 1));
-    if(!world->all_components_data) exit(EXIT_FAILURE);
+    world->all_components_data = realloc(
+        world->all_components_data,
+        sizeof(ComponentData) * (world->number_of_components + 1));
+    if(!world->all_components_data) exit(EXIT_FAILURE);
+
+    component_data_init(
+        &world->all_components_data[world->number_of_components],
+        field_sizes,
+        number_of_fields,
+        storage);
+
+    if (storage == COMPONENT_STORAGE_SPARSE) {
+        world->all_components_data[world->number_of_components].set.first_index = world->first_entity_index;
+        world->sparse_components = realloc(
+            world->sparse_components,
+            sizeof(comp_id_t) * (world->number_of_sparse_components + 1));
+        if(!world->sparse_components) exit(EXIT_FAILURE);
+        world->sparse_components[world->number_of_sparse_components++] = world->number_of_components;
+    }
+
+    return world->number_of_components++;
+}
+
+comp_id_t world_add_component_type(World* world, const comp_size_t* field_sizes, const comp_size_t number_of_fields) {
+    return world_add_component_type_with_storage(world, field_sizes, number_of_fields, COMPONENT_STORAGE_TABLE);
+}
+
+static bool world_is_sparse_component(const World* world, const comp_id_t component_id) {
+    return world->all_components_data[component_id].storage == COMPONENT_STORAGE_SPARSE;
+}
+
+const ComponentSet* world_get_component_set(const World* world, const comp_id_t component_id) {
+    return world_is_sparse_component(world, component_id) ? &world->all_components_data[component_id].set : NULL;
+}
+
+//gives the entity an uninitialized row in the component's set
+static void world_insert_sparse_row(World* world, const id_t entity_id, const comp_id_t component_id) {
+    ComponentData* component_data = &world->all_components_data[component_id];
+    component_set_insert(&component_data->set, component_data->field_sizes, component_data->number_of_fields, entity_id);
+}
+
+static void world_remove_sparse_row(World* world, const id_t entity_id, const comp_id_t component_id) {
+    ComponentData* component_data = &world->all_components_data[component_id];
+    component_set_remove(&component_data->set, component_data->field_sizes, component_data->number_of_fields, entity_id);
+}
+
+static void world_remove_all_sparse_rows(World* world, const id_t entity_id) {
+    for (comp_id_t s = 0; s < world->number_of_sparse_components; s++) {
+        world_remove_sparse_row(world, entity_id, world->sparse_components[s]);
+    }
+}
+
+//the sparse components of a spawn list, the table ones are handled by the archetype
+static void world_insert_sparse_rows(World* world, const id_t entity_id, const comp_id_t number_of_components, const comp_id_t* components) {
+    if (world->number_of_sparse_components == 0) {
+        return;
+    }
+    for (comp_id_t c = 0; c < number_of_components; c++) {
+        if (world_is_sparse_component(world, components[c])) {
+            world_insert_sparse_row(world, entity_id, components[c]);
+        }
+    }
+}
+
+//position of the entity's index in the sparse array, indexes of other worlds' ranges
+//below first_entity_index wrap around to values no sparse chunk covers
+static id_t world_entity_slot(const World* world, const id_t entity_id) {
+    return ENTITY_INDEX(entity_id) - world->first_entity_index;
+}
+
+//the sparse entry of an entity's slot, the slot's page must exist
+static SparseEntry* world_sparse_entry(const World* world, const id_t entity_id) {
+    const id_t slot = world_entity_slot(world, entity_id);
+    assert((slot >> world->sparse_array_chunk_shift) < world->sparse_array_number_of_chunks);
+    assert(world->sparse_array_chunks[slot >> world->sparse_array_chunk_shift].entries);
+    return &world->sparse_array_chunks[slot >> world->sparse_array_chunk_shift].entries[slot & (world->sparse_array_chunk_size - 1)];
+}
+
+//NULL if the slot has no page
+static SparseEntry* world_find_sparse_entry(const World* world, const id_t entity_id) {
+    const id_t slot = world_entity_slot(world, entity_id);
+    const chunks_length_t page = slot >> world->sparse_array_chunk_shift;
+    if (page >= world->sparse_array_number_of_chunks || !world->sparse_array_chunks[page].entries) {
+        return NULL;
+    }
+    return &world->sparse_array_chunks[page].entries[slot & (world->sparse_array_chunk_size - 1)];
+}
+
+//NULL for ids that are out of range, removed or stale
+static const SparseEntry* world_live_sparse_entry(const World* world, const id_t entity_id) {
+    const SparseEntry* entry = world_find_sparse_entry(world, entity_id);
+    if (!entry || entry->archetype == ARCH_ID_INVALID || entry->generation != ENTITY_GENERATION(entity_id)) {
+        return NULL;
+    }
+    return entry;
+}
+
+//finds the entity's location using the sparse array
+static void world_locate_entity(
+    const World* world,
+    const id_t entity_id,
+    arch_id_t* archetype_id,
+    chunks_length_t* chunk_index,
+    id_t* dense_id_array_index)
+{
+    const SparseEntry* entry = world_sparse_entry(world, entity_id);
+    *archetype_id = entry->archetype;
+    *chunk_index = entry->chunk_index;
+    *dense_id_array_index = entry->dense_id_array_index;
+}
+
+static void world_set_entity_location(
+    World* world,
+    const id_t entity_id,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const id_t dense_id_array_index)
+{
+    SparseEntry* entry = world_sparse_entry(world, entity_id);
+    entry->archetype = archetype_id;
+    entry->chunk_index = chunk_index;
+    entry->dense_id_array_index = dense_id_array_index;
+}
+
+bool world_is_alive(const World* world, const id_t entity_id) {
+    return world_live_sparse_entry(world, entity_id) != NULL;
+}
+
+bool world_get_entity_location(
+    const World* world,
+    const id_t entity_id,
+    arch_id_t* archetype_id,
+    chunks_length_t* chunk_index,
+    chunk_size_t* row)
+{
+    const SparseEntry* entry = world_live_sparse_entry(world, entity_id);
+    if (!entry) {
+        return false;
+    }
+    *archetype_id = entry->archetype;
+    *chunk_index = entry->chunk_index;
+    *row = entry->dense_id_array_index;
+    return true;
+}
+
+//the stack doubles, it is never filled in advance
+static void world_reserve_id_stack(World* world, const id_t number_of_positions) {
+    if (number_of_positions > world->id_stack_capacity) {
+        id_t capacity = world->id_stack_capacity ? world->id_stack_capacity : 64;
+        while (number_of_positions > capacity) {
+            capacity *= 2;
+        }
+        world->id_stack_ids = realloc(world->id_stack_ids, sizeof(id_t) * capacity);
+        if(!world->id_stack_ids) exit(EXIT_FAILURE);
+        world->id_stack_capacity = capacity;
+    }
+}
+
+//bumps the generation so every handle to the slot goes stale and returns the index to the stack
+static void world_release_id(World* world, const id_t entity_id) {
+    world_remove_all_sparse_rows(world, entity_id);
+    SparseEntry* entry = world_sparse_entry(world, entity_id);
+    entry->archetype = ARCH_ID_INVALID;
+    entry->generation = (entry->generation + 1) & ENTITY_GENERATION_MASK;
+    world_reserve_id_stack(world, world->id_stack_top_index + 1);
+    world->id_stack_ids[world->id_stack_top_index++] = ENTITY_INDEX(entity_id);
+}
+
+//world_release_id for a whole id array: the ids go on the stack with one memcpy and lose their generation bits there
+static void world_release_ids(World* world, const id_t* entity_ids, const id_t number_of_ids) {
+    world_reserve_id_stack(world, world->id_stack_top_index + number_of_ids);
+    id_t* indexes = &world->id_stack_ids[world->id_stack_top_index];
+    memcpy(indexes, entity_ids, sizeof(id_t) * number_of_ids);
+    world->id_stack_top_index += number_of_ids;
+    for (id_t i = 0; i < number_of_ids; i++) {
+        world_remove_all_sparse_rows(world, entity_ids[i]);
+        SparseEntry* entry = world_sparse_entry(world, entity_ids[i]);
+        entry->archetype = ARCH_ID_INVALID;
+        entry->generation = (entry->generation + 1) & ENTITY_GENERATION_MASK;
+        indexes[i] = ENTITY_INDEX(indexes[i]);
+    }
+}
+
+//the directory grows geometrically, the new entries have no page yet
+static void world_reserve_sparse_directory(World* world, const chunks_length_t number_of_pages) {
+    if (number_of_pages <= world->sparse_array_number_of_chunks) {
+        return;
+    }
+    if (number_of_pages > world->sparse_array_chunks_capacity) {
+        chunks_length_t capacity = world->sparse_array_chunks_capacity;
+        while (capacity < number_of_pages) {
+            capacity *= 2;
+        }
+        world->sparse_array_chunks = realloc(world->sparse_array_chunks, sizeof(SparseArrayChunk) * capacity);
+        if(!world->sparse_array_chunks) exit(EXIT_FAILURE);
+        world->sparse_array_chunks_capacity = capacity;
+    }
+    for (chunks_length_t page = world->sparse_array_number_of_chunks; page < number_of_pages; page++) {
+        world->sparse_array_chunks[page].entries = NULL;
+    }
+    world->sparse_array_number_of_chunks = number_of_pages;
+}
+
+//allocates the page of the slot if it has none
+static void world_reserve_sparse_page(World* world, const id_t slot) {
+    const chunks_length_t page = slot >> world->sparse_array_chunk_shift;
+    world_reserve_sparse_directory(world, page + 1);
+    if (!world->sparse_array_chunks[page].entries) {
+        sparse_array_chunk_init(&world->sparse_array_chunks[page], world->sparse_array_chunk_size);
+    }
+}
+
+//pops number_of_ids released indexes, then takes fresh ones, and turns them into handles with the slot's
+//current generation. They stay readable at the returned address until the next pop or release.
+static const id_t* world_pop_ids(World* world, const id_t number_of_ids) {
+    const id_t number_of_released = number_of_ids < world->id_stack_top_index ? number_of_ids : world->id_stack_top_index;
+    const id_t number_of_fresh = number_of_ids - number_of_released;
+    //the world's index range is used up, handing out more would collide with another world's ids
+    if(number_of_fresh > world->number_of_entity_indexes - world->next_entity_slot) exit(EXIT_FAILURE);
+
+    //the released indexes stay where they are and the fresh ones are written behind them
+    world->id_stack_top_index -= number_of_released;
+    world_reserve_id_stack(world, world->id_stack_top_index + number_of_ids);
+    id_t* ids = &world->id_stack_ids[world->id_stack_top_index];
+    for (id_t i = 0; i < number_of_fresh; i++) {
+        ids[number_of_released + i] = world->first_entity_index + world->next_entity_slot++;
+    }
+
+    for (id_t i = 0; i < number_of_ids; i++) {
+        world_reserve_sparse_page(world, world_entity_slot(world, ids[i]));
+        ids[i] = ENTITY_ID(ids[i], world_sparse_entry(world, ids[i])->generation);
+    }
+    return ids;
+}
+
+static id_t world_add_entity_to_archetype(World* world, const arch_id_t archetype_id) {
+    const id_t id = *world_pop_ids(world, 1);
+
+    chunks_length_t chunk_index = 0;
+    id_t id_dense_array_index = 0;
+
+    Archetype* archetype = &world->archetypes[archetype_id];
+    const chunks_length_t number_of_chunks = archetype->number_of_chunks;
+    archetype_add_entity(
+        archetype,
+        id,
+        &world->chunk_pool,
+        &id_dense_array_index,
+        &chunk_index);
+    if (archetype->number_of_chunks != number_of_chunks) {
+        world_on_chunk_added(world, archetype_id, chunk_index);
+    }
+    world_touch_chunk(world, archetype, chunk_index);
+
+    world_set_entity_location(world, id, archetype_id, chunk_index, id_dense_array_index);
+    return id;
+}
+
+//upper bound of the ranges world_add_entities_to_archetype can produce
+static chunks_length_t world_max_spawn_ranges(const World* world, const arch_id_t archetype_id, const id_t number_of_entities) {
+    const Archetype* archetype = &world->archetypes[archetype_id];
+    return archetype->number_of_free_chunks + (number_of_entities + archetype->chunk_size - 1) / archetype->chunk_size;
+}
+
+//fills the free chunks first and then new ones, writing every touched row range to out_ranges if given
+static chunks_length_t world_add_entities_to_archetype(
+    World* world,
+    const arch_id_t archetype_id,
+    const id_t number_of_entities,
+    id_t* out_ids,
+    ChunkRange* out_ranges)
+{
+    if (number_of_entities == 0) {
+        return 0;
+    }
+    const id_t* ids = world_pop_ids(world, number_of_entities);
+
+    Archetype* archetype = &world->archetypes[archetype_id];
+    const chunk_size_t chunk_size = archetype->chunk_size;
+
+    //grow the chunk array once for everything that does not fit into the free chunks
+    size_t free_rows = 0;
+    for (chunks_length_t f = 0; f < archetype->number_of_free_chunks; f++) {
+        free_rows += chunk_size - archetype->chunks[archetype->free_chunks[f]].dense_arrays_length;
+    }
+    if (number_of_entities > free_rows) {
+        const chunks_length_t new_chunks = (number_of_entities - free_rows + chunk_size - 1) / chunk_size;
+        archetype_reserve_chunks(archetype, archetype->number_of_chunks + new_chunks);
+    }
+
+    chunks_length_t number_of_ranges = 0;
+    id_t spawned = 0;
+    while (spawned < number_of_entities) {
+        if (archetype->number_of_free_chunks == 0) {
+            const chunks_length_t new_chunk = archetype_add_chunk(archetype, &world->chunk_pool);
+            world_on_chunk_added(world, archetype_id, new_chunk);
+        }
+        const chunks_length_t chunk_index = archetype->free_chunks[archetype->number_of_free_chunks - 1];
+        ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+
+        const chunk_size_t begin = chunk->dense_arrays_length;
+        const chunk_size_t space = chunk_size - begin;
+        const chunk_size_t count = number_of_entities - spawned < space ? number_of_entities - spawned : space;
+
+        memcpy(&chunk->id_dense_array[begin], &ids[spawned], sizeof(id_t) * count);
+        for (chunk_size_t r = 0; r < count; r++) {
+            world_set_entity_location(world, ids[spawned + r], archetype_id, chunk_index, begin + r);
+        }
+        chunk->dense_arrays_length += count;
+        if (chunk->dense_arrays_length == chunk_size) {
+            archetype->number_of_free_chunks--;
+        }
+        world_touch_chunk(world, archetype, chunk_index);
+
+        if (out_ranges) {
+            out_ranges[number_of_ranges].archetype_id = archetype_id;
+            out_ranges[number_of_ranges].chunk_index = chunk_index;
+            out_ranges[number_of_ranges].begin = begin;
+            out_ranges[number_of_ranges].end = begin + count;
+        }
+        number_of_ranges++;
+        spawned += count;
+    }
+
+    if (out_ids) {
+        memcpy(out_ids, ids, sizeof(id_t) * number_of_entities);
+    }
+    return number_of_ranges;
+}
+
+//finds the archetype with exactly these table components, creating it if needed
+static arch_id_t world_get_or_add_archetype(World* world, const comp_id_t number_of_components, const comp_id_t* components) {
+    //the mask does not depend on the order of the components, sparse ones are not part of it
+    ComponentMask mask;
+    component_mask_init(&mask, components, number_of_components);
+    for (comp_id_t s = 0; s < world->number_of_sparse_components; s++) {
+        const comp_id_t sparse = world->sparse_components[s];
+        mask.words[sparse / 64] &= ~((uint64_t)1 << (sparse % 64));
+    }
+
+    arch_id_t matched_arch_id = 0;
+    if (!world_match_archetype(world, &mask, &matched_arch_id)) {
+        matched_arch_id = world_add_archetype_from_mask(world, &mask);
+    }
+    return matched_arch_id;
+}
+
+id_t world_add_entity(World* world, const comp_id_t number_of_components, const comp_id_t* components) {
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_add_entity");
+    const id_t id = world_add_entity_to_archetype(world, world_get_or_add_archetype(world, number_of_components, components));
+    world_insert_sparse_rows(world, id, number_of_components, components);
+    ECS_PROFILE_ZONE_END(zone);
+    return id;
+}
+
+chunks_length_t world_add_entities(
+    World* world,
+    const id_t number_of_entities,
+    const comp_id_t number_of_components,
+    const comp_id_t* components,
+    id_t* out_ids,
+    ChunkRange** out_ranges)
+{
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_add_entities");
+    const arch_id_t archetype_id = world_get_or_add_archetype(world, number_of_components, components);
+
+    ChunkRange* ranges = NULL;
+    if (out_ranges) {
+        ranges = malloc(sizeof(ChunkRange) * (world_max_spawn_ranges(world, archetype_id, number_of_entities) + 1));
+        if(!ranges) exit(EXIT_FAILURE);
+        *out_ranges = ranges;
+    }
+
+    bool has_sparse = false;
+    for (comp_id_t c = 0; c < number_of_components; c++) {
+        has_sparse |= world_is_sparse_component(world, components[c]);
+    }
+    if (!has_sparse) {
+        const chunks_length_t number_of_ranges = world_add_entities_to_archetype(world, archetype_id, number_of_entities, out_ids, ranges);
+        ECS_PROFILE_ZONE_END(zone);
+        return number_of_ranges;
+    }
+
+    //the sparse rows need the ids even if the caller does not
+    id_t* ids = out_ids ? out_ids : malloc(sizeof(id_t) * number_of_entities);
+    if(!ids && number_of_entities) exit(EXIT_FAILURE);
+    const chunks_length_t number_of_ranges = world_add_entities_to_archetype(world, archetype_id, number_of_entities, ids, ranges);
+    for (id_t i = 0; i < number_of_entities; i++) {
+        world_insert_sparse_rows(world, ids[i], number_of_components, components);
+    }
+    if (!out_ids) {
+        free(ids);
+    }
+    ECS_PROFILE_ZONE_END(zone);
+    return number_of_ranges;
+}
+
+void* world_get_chunk_field(
+    World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const comp_id_t component_id,
+    const comp_size_t field_index)
+{
+    const Archetype* archetype = &world->archetypes[archetype_id];
+    if (!component_mask_has(&archetype->mask, component_id) || field_index >= world->all_components_data[component_id].number_of_fields) {
+        return NULL;
+    }
+    ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+    const uint32_t column = archetype->component_columns[archetype_component_index(archetype, component_id)] + field_index;
+    chunk->column_ticks[column] = world->change_tick;
+    return chunk->columns[column];
+}
+
+void** world_get_chunk_component_fields(
+    const World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const comp_id_t component_id)
+{
+    const Archetype* archetype = &world->archetypes[archetype_id];
+    if (!component_mask_has(&archetype->mask, component_id)) {
+        return NULL;
+    }
+    return archetype_chunk_component_fields(archetype, &archetype->chunks[chunk_index], component_id);
+}
+
+//swap-and-pop of a row, the entity moved into the hole gets its sparse entry patched
+static void world_remove_row(World* world, Archetype* archetype, const chunks_length_t chunk_index, const id_t dense_id_array_index) {
+    ArchetypeDataChunk* archetype_data_chunk = &archetype->chunks[chunk_index];
+    world_touch_chunk(world, archetype, chunk_index);
+
+    const id_t dense_id_array_length = archetype_data_chunk->dense_arrays_length;
+    const id_t last_element_index = dense_id_array_length - 1;
+
+    // If the entity to be removed is the last one in the array,
+    // we can simply decrement the length. No swapping is needed.
+    if (dense_id_array_index == last_element_index) {
+        archetype_pop_row(archetype, chunk_index);
+        return;
+    }
+
+    //get the ID of the entity at the last position.
+    const id_t last_entity_id = archetype_data_chunk->id_dense_array[last_element_index];
+
+    //move the last entity's ID into the deleted entity's slot.
+    archetype_data_chunk->id_dense_array[dense_id_array_index] = last_entity_id;
+
+    //move the last entity's component data into the deleted entity's slot.
+    archetype_copy_row(archetype, archetype_data_chunk, dense_id_array_index, archetype_data_chunk, last_element_index);
+
+
+    //update the sparse array for the moved entity
+    world_sparse_entry(world, last_entity_id)->dense_id_array_index = dense_id_array_index;
+
+    archetype_pop_row(archetype, chunk_index);
+}
+
+void world_remove_entity(World* world, const id_t entity_id) {
+    if (!world_is_alive(world, entity_id)) {
+        return;
+    }
+
+    //find the location of the entity to be removed
+    arch_id_t archetype_id;
+    chunks_length_t chunk_index;
+    id_t dense_id_array_index;
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_remove_entity");
+    world_locate_entity(world, entity_id, &archetype_id, &chunk_index, &dense_id_array_index);
+
+    //return the deleted ID to the stack
+    world_release_id(world, entity_id);
+
+    world_remove_row(world, &world->archetypes[archetype_id], chunk_index, dense_id_array_index);
+    ECS_PROFILE_ZONE_END(zone);
+}
+
+typedef struct RowLocation {
+    id_t entity_id;
+    id_t dense_id_array_index;
+    chunks_length_t chunk_index;
+    arch_id_t archetype_id;
+} RowLocation;
+
+//archetype and chunk ascending, row descending
+static int compare_row_locations(const void* a, const void* b) {
+    const RowLocation* location_a = a;
+    const RowLocation* location_b = b;
+    if (location_a->archetype_id != location_b->archetype_id) return location_a->archetype_id < location_b->archetype_id ? -1 : 1;
+    if (location_a->chunk_index != location_b->chunk_index) return location_a->chunk_index < location_b->chunk_index ? -1 : 1;
+    if (location_a->dense_id_array_index != location_b->dense_id_array_index) return location_a->dense_id_array_index > location_b->dense_id_array_index ? -1 : 1;
+    return 0;
+}
+
+//removing the rows of a chunk from the highest down means every swap-and-pop only moves a row
+//that is not queued, so the locations looked up once at the start stay valid
+//the moves of a chunk are planned first and then applied one field array at a time
+void world_remove_entities(World* world, const id_t* entity_ids, const id_t number_of_entities) {
+    if (number_of_entities == 0) {
+        return;
+    }
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_remove_entities");
+    RowLocation* locations = malloc(sizeof(RowLocation) * number_of_entities);
+    if(!locations) exit(EXIT_FAILURE);
+    //row moves of the current chunk, applied in this order
+    id_t* move_sources = malloc(sizeof(id_t) * number_of_entities);
+    if(!move_sources) exit(EXIT_FAILURE);
+    id_t* move_destinations = malloc(sizeof(id_t) * number_of_entities);
+    if(!move_destinations) exit(EXIT_FAILURE);
+
+    //stale handles are skipped
+    id_t number_of_locations = 0;
+    for (id_t i = 0; i < number_of_entities; i++) {
+        if (!world_is_alive(world, entity_ids[i])) {
+            continue;
+        }
+        RowLocation* location = &locations[number_of_locations++];
+        location->entity_id = entity_ids[i];
+        world_locate_entity(world, entity_ids[i], &location->archetype_id, &location->chunk_index, &location->dense_id_array_index);
+    }
+    qsort(locations, number_of_locations, sizeof(RowLocation), compare_row_locations);
+
+    id_t i = 0;
+    while (i < number_of_locations) {
+        Archetype* archetype = &world->archetypes[locations[i].archetype_id];
+        const chunks_length_t chunk_index = locations[i].chunk_index;
+        ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+
+        id_t length = chunk->dense_arrays_length;
+        id_t number_of_moves = 0;
+        id_t end = i;
+        for (; end < number_of_locations && locations[end].archetype_id == locations[i].archetype_id && locations[end].chunk_index == chunk_index; end++) {
+            //the same entity listed twice
+            if (end > i && locations[end - 1].dense_id_array_index == locations[end].dense_id_array_index) {
+                continue;
+            }
+            world_release_id(world, locations[end].entity_id);
+
+            const id_t row = locations[end].dense_id_array_index;
+            const id_t last = --length;
+            if (row != last) {
+                const id_t moved_entity_id = chunk->id_dense_array[last];
+                chunk->id_dense_array[row] = moved_entity_id;
+                world_sparse_entry(world, moved_entity_id)->dense_id_array_index = row;
+                move_sources[number_of_moves] = last;
+                move_destinations[number_of_moves++] = row;
+            }
+        }
+
+        archetype_move_rows(archetype, chunk, move_destinations, move_sources, number_of_moves);
+
+        archetype_pop_rows(archetype, chunk_index, chunk->dense_arrays_length - length);
+        world_touch_chunk(world, archetype, chunk_index);
+        i = end;
+    }
+
+    free(move_destinations);
+    free(move_sources);
+    free(locations);
+    ECS_PROFILE_ZONE_END(zone);
+}
+
+#ifndef NDEBUG
+//sparse components are in no archetype mask, a query term on one would silently match nothing
+static bool world_desc_is_table_only(const World* world, const QueryDesc* desc) {
+    const comp_id_t* lists[] = { desc->required, desc->excluded, desc->optional, desc->any_of };
+    const comp_id_t counts[] = { desc->number_of_required, desc->number_of_excluded, desc->number_of_optional, desc->number_of_any_of };
+    for (uint32_t l = 0; l < 4; l++) {
+        for (comp_id_t i = 0; i < counts[l]; i++) {
+            if (world_is_sparse_component(world, lists[l][i])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+#endif
+
+void world_clear_query(World* world, const comp_id_t* component_ids, const comp_id_t number_of_components) {
+    const QueryDesc desc = { .required = component_ids, .number_of_required = number_of_components };
+    assert(world_desc_is_table_only(world, &desc));
+    (void)desc;
+
+    ComponentMask query_mask;
+    component_mask_init(&query_mask, component_ids, number_of_components);
+
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        Archetype* archetype = &world->archetypes[a];
+        if (!component_mask_contains(&archetype->mask, &query_mask)) {
+            continue;
+        }
+        //no row moves, the ids of every chunk just go back on the stack
+        for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+            const ArchetypeDataChunk* chunk = &archetype->chunks[ch];
+            world_release_ids(world, chunk->id_dense_array, chunk->dense_arrays_length);
+            world_touch_chunk(world, archetype, ch);
+        }
+        archetype_clear(archetype);
+    }
+}
+
+//returns the archetype reached from archetype_id by adding or removing one component,
+//the result is cached as an edge on both archetypes
+static arch_id_t world_archetype_transition(World* world, const arch_id_t archetype_id, const comp_id_t component_id, const bool add) {
+    ArchetypeEdge* edge = archetype_get_edge(&world->archetypes[archetype_id], component_id);
+    const arch_id_t cached = add ? edge->add : edge->remove;
+    if (cached != ARCH_ID_INVALID) {
+        return cached;
+    }
+
+    ComponentMask mask = world->archetypes[archetype_id].mask;
+    if (add) {
+        mask.words[component_id / 64] |= (uint64_t)1 << (component_id % 64);
+    } else {
+        mask.words[component_id / 64] &= ~((uint64_t)1 << (component_id % 64));
+    }
+
+    arch_id_t target = archetype_id;
+    if (!component_mask_equals(&mask, &world->archetypes[archetype_id].mask) && !world_match_archetype(world, &mask, &target)) {
+        //may reallocate world->archetypes, so edge pointers are fetched again below
+        target = world_add_archetype_from_mask(world, &mask);
+    }
+
+    edge = archetype_get_edge(&world->archetypes[archetype_id], component_id);
+    ArchetypeEdge* reverse_edge = archetype_get_edge(&world->archetypes[target], component_id);
+    if (add) {
+        edge->add = target;
+        if (target != archetype_id) reverse_edge->remove = archetype_id;
+    } else {
+        edge->remove = target;
+        if (target != archetype_id) reverse_edge->add = archetype_id;
+    }
+    return target;
+}
+
+//moves the entity's row to the target archetype, copying the fields both archetypes share
+static void world_move_entity(World* world, const id_t entity_id, const arch_id_t target_archetype_id) {
+    arch_id_t source_archetype_id;
+    chunks_length_t source_chunk_index;
+    id_t source_index;
+    world_locate_entity(world, entity_id, &source_archetype_id, &source_chunk_index, &source_index);
+    if (source_archetype_id == target_archetype_id) {
+        return;
+    }
+
+    Archetype* target = &world->archetypes[target_archetype_id];
+    const chunks_length_t number_of_chunks = target->number_of_chunks;
+    chunks_length_t target_chunk_index = 0;
+    id_t target_index = 0;
+    archetype_add_entity(
+        target,
+        entity_id,
+        &world->chunk_pool,
+        &target_index,
+        &target_chunk_index);
+    if (target->number_of_chunks != number_of_chunks) {
+        world_on_chunk_added(world, target_archetype_id, target_chunk_index);
+    }
+    world_touch_chunk(world, target, target_chunk_index);
+
+    Archetype* source = &world->archetypes[source_archetype_id];
+    const ArchetypeDataChunk* source_chunk = &source->chunks[source_chunk_index];
+    const ArchetypeDataChunk* target_chunk = &target->chunks[target_chunk_index];
+    for (comp_id_t c = 0; c < target->number_of_components; c++) {
+        const comp_id_t component_index = target->components[c];
+        if (!component_mask_has(&source->mask, component_index)) {
+            continue;
+        }
+        const uint32_t target_column = target->component_columns[c];
+        const uint32_t source_column = source->component_columns[archetype_component_index(source, component_index)];
+        const comp_size_t number_of_fields = world->all_components_data[component_index].number_of_fields;
+        for (comp_size_t f = 0; f < number_of_fields; f++) {
+            const size_t field_size = target->column_sizes[target_column + f];
+            uint8_t* dest = (uint8_t*)target_chunk->columns[target_column + f] + (target_index * field_size);
+            const uint8_t* src = (const uint8_t*)source_chunk->columns[source_column + f] + (source_index * field_size);
+            row_copy_field(dest, src, field_size);
+        }
+    }
+
+    world_remove_row(world, source, source_chunk_index, source_index);
+    world_set_entity_location(world, entity_id, target_archetype_id, target_chunk_index, target_index);
+}
+
+void world_add_component(World* world, const id_t entity_id, const comp_id_t component_id) {
+    if (!world_is_alive(world, entity_id)) {
+        return;
+    }
+    if (world_is_sparse_component(world, component_id)) {
+        world_insert_sparse_row(world, entity_id, component_id);
+        return;
+    }
+    arch_id_t archetype_id;
+    chunks_length_t chunk_index;
+    id_t dense_id_array_index;
+    world_locate_entity(world, entity_id, &archetype_id, &chunk_index, &dense_id_array_index);
+
+    world_move_entity(world, entity_id, world_archetype_transition(world, archetype_id, component_id, true));
+}
+
+void world_remove_component(World* world, const id_t entity_id, const comp_id_t component_id) {
+    if (!world_is_alive(world, entity_id)) {
+        return;
+    }
+    if (world_is_sparse_component(world, component_id)) {
+        world_remove_sparse_row(world, entity_id, component_id);
+        return;
+    }
+    arch_id_t archetype_id;
+    chunks_length_t chunk_index;
+    id_t dense_id_array_index;
+    world_locate_entity(world, entity_id, &archetype_id, &chunk_index, &dense_id_array_index);
+
+    world_move_entity(world, entity_id, world_archetype_transition(world, archetype_id, component_id, false));
+}
+
+//the field of the entity's row in a sparse component's set, the caller checked that the entity lives
+static void* world_get_sparse_field(const World* world, const id_t entity_id, const comp_id_t component_id, const comp_size_t field_index) {
+    const ComponentData* component_data = &world->all_components_data[component_id];
+    const id_t found = component_set_find(&component_data->set, entity_id);
+    if (!found || field_index >= component_data->number_of_fields) {
+        return NULL;
+    }
+    return (uint8_t*)component_data->set.fields[field_index] + (size_t)(found - 1) * component_data->field_sizes[field_index];
+}
+
+bool world_has_component(const World* world, const id_t entity_id, const comp_id_t component_id) {
+    const SparseEntry* entry = world_live_sparse_entry(world, entity_id);
+    if (!entry || component_id >= world->number_of_components) {
+        return false;
+    }
+    if (world_is_sparse_component(world, component_id)) {
+        return component_set_find(&world->all_components_data[component_id].set, entity_id) != 0;
+    }
+    return component_mask_has(&world->archetypes[entry->archetype].mask, component_id);
+}
+
+//the entity's row in one field column, NULL if the entity is gone or lacks the component or field.
+//out_column is only set for table components.
+static uint8_t* world_find_component_field(
+    const World* world,
+    const id_t entity_id,
+    const comp_id_t component_id,
+    const comp_size_t field_index,
+    ArchetypeDataChunk** out_chunk,
+    uint32_t* out_column
+)
+{
+    //find the entity's location using the sparse array, a removed entity has no archetype
+    //and a recycled slot has a newer generation
+    const SparseEntry* entry = world_live_sparse_entry(world, entity_id);
+    if (!entry) {
+        return NULL;
+    }
+    if (world_is_sparse_component(world, component_id)) {
+        *out_chunk = NULL;
+        return world_get_sparse_field(world, entity_id, component_id, field_index);
+    }
+    const chunks_length_t chunk_index = entry->chunk_index;
+    const id_t dense_id_array_index = entry->dense_id_array_index;
+
+    const Archetype* archetype = &world->archetypes[entry->archetype];
+
+    //validate that the entity actually has this component
+    if (!component_mask_has(&archetype->mask, component_id)) {
+        return NULL; //this entity does not have the requested component
+    }
+
+    //validate the field index
+    const ComponentData* component_data = &world->all_components_data[component_id];
+    if (field_index >= component_data->number_of_fields) {
+        return NULL; // The component does not have this many fields
+    }
+
+    //calculate the pointer to the specific field data
+    ArchetypeDataChunk* archetype_data_chunk = &archetype->chunks[chunk_index];
+    const comp_size_t field_size = component_data->field_sizes[field_index];
+
+    //get the base address of the dense array for this specific component field
+    const uint32_t column = archetype->component_columns[archetype_component_index(archetype, component_id)] + field_index;
+    uint8_t* field_array_base = archetype_data_chunk->columns[column];
+    *out_chunk = archetype_data_chunk;
+    *out_column = column;
+
+    //calculate the offset to the entity's data within that array
+    return field_array_base + (dense_id_array_index * field_size);
+}
+
+void* world_get_component_field(
+    World* world,
+    const id_t entity_id,
+    const comp_id_t component_id,
+    const comp_size_t field_index
+)
+{
+    ArchetypeDataChunk* chunk;
+    uint32_t column;
+    uint8_t* field = world_find_component_field(world, entity_id, component_id, field_index, &chunk, &column);
+    //the caller may write through it so the column is stamped
+    if (field && chunk) {
+        chunk->column_ticks[column] = world->change_tick;
+    }
+    return field;
+}
+
+const void* world_read_component_field(
+    const World* world,
+    const id_t entity_id,
+    const comp_id_t component_id,
+    const comp_size_t field_index
+)
+{
+    ArchetypeDataChunk* chunk;
+    uint32_t column;
+    return world_find_component_field(world, entity_id, component_id, field_index, &chunk, &column);
+}
+
+//lookups ahead whose sparse entry is prefetched, the chunk's column table follows at half the distance
+#define BATCH_PREFETCH_DISTANCE 16
+
+void world_get_component_fields(
+    World* world,
+    const id_t* entity_ids,
+    const id_t number_of_entities,
+    const comp_id_t component_id,
+    const comp_size_t field_index,
+    void** out_fields)
+{
+    if (component_id >= world->number_of_components || field_index >= world->all_components_data[component_id].number_of_fields) {
+        for (id_t i = 0; i < number_of_entities; i++) {
+            out_fields[i] = NULL;
+        }
+        return;
+    }
+    if (world_is_sparse_component(world, component_id)) {
+        for (id_t i = 0; i < number_of_entities; i++) {
+            out_fields[i] = world_is_alive(world, entity_ids[i]) ? world_get_sparse_field(world, entity_ids[i], component_id, field_index) : NULL;
+        }
+        return;
+    }
+    const size_t field_size = world->all_components_data[component_id].field_sizes[field_index];
+
+    //consecutive entities usually share an archetype, the column is only resolved when it changes
+    arch_id_t cached_archetype_id = ARCH_ID_INVALID;
+    bool cached_has_component = false;
+    uint32_t cached_column = 0;
+
+    for (id_t i = 0; i < number_of_entities; i++) {
+        if (i + BATCH_PREFETCH_DISTANCE < number_of_entities) {
+            const id_t ahead = entity_ids[i + BATCH_PREFETCH_DISTANCE];
+            const SparseEntry* entry = world_find_sparse_entry(world, ahead);
+            if (entry) {
+                PREFETCH(entry);
+            }
+        }
+        if (i + BATCH_PREFETCH_DISTANCE / 2 < number_of_entities) {
+            const SparseEntry* ahead = world_live_sparse_entry(world, entity_ids[i + BATCH_PREFETCH_DISTANCE / 2]);
+            if (ahead) {
+                PREFETCH(world->archetypes[ahead->archetype].chunks[ahead->chunk_index].columns);
+            }
+        }
+
+        const SparseEntry* entry = world_live_sparse_entry(world, entity_ids[i]);
+        if (!entry) {
+            out_fields[i] = NULL;
+            continue;
+        }
+        const Archetype* archetype = &world->archetypes[entry->archetype];
+        if (entry->archetype != cached_archetype_id) {
+            cached_archetype_id = entry->archetype;
+            cached_has_component = component_mask_has(&archetype->mask, component_id);
+            if (cached_has_component) {
+                cached_column = archetype->component_columns[archetype_component_index(archetype, component_id)] + field_index;
+            }
+        }
+        if (!cached_has_component) {
+            out_fields[i] = NULL;
+            continue;
+        }
+        ArchetypeDataChunk* chunk = &archetype->chunks[entry->chunk_index];
+        chunk->column_ticks[cached_column] = world->change_tick;
+        out_fields[i] = (uint8_t*)chunk->columns[cached_column] + entry->dense_id_array_index * field_size;
+    }
+}
+
+//Transfer Functions
+typedef struct TransferRow {
+    RowLocation location;
+    //position of the entity among the live ids, where its new id goes in out_ids
+    id_t output_index;
+} TransferRow;
+
+static int compare_transfer_rows(const void* a, const void* b) {
+    return compare_row_locations(&((const TransferRow*)a)->location, &((const TransferRow*)b)->location);
+}
+
+static comp_id_t transfer_remap(const comp_id_t* component_remap, const comp_id_t component_id) {
+    return component_remap ? component_remap[component_id] : component_id;
+}
+
+static bool transfer_layouts_match(const World* source, const World* target, const comp_id_t source_component, const comp_id_t target_component) {
+    if (target_component >= target->number_of_components) {
+        return false;
+    }
+    const ComponentData* source_data = &source->all_components_data[source_component];
+    const ComponentData* target_data = &target->all_components_data[target_component];
+    return source_data->number_of_fields == target_data->number_of_fields &&
+           memcmp(source_data->field_sizes, target_data->field_sizes, sizeof(comp_size_t) * source_data->number_of_fields) == 0;
+}
+
+//every component a transfer copies needs the same fields on both sides, checked once per source archetype
+//of the sorted rows and once per sparse component before anything moves
+static bool transfer_remap_valid(const World* source, const World* target, const TransferRow* rows, const id_t number_of_rows, const comp_id_t* component_remap) {
+    for (id_t r = 0; r < number_of_rows; r++) {
+        if (r > 0 && rows[r - 1].location.archetype_id == rows[r].location.archetype_id) {
+            continue;
+        }
+        const Archetype* archetype = &source->archetypes[rows[r].location.archetype_id];
+        for (comp_id_t c = 0; c < archetype->number_of_components; c++) {
+            if (!transfer_layouts_match(source, target, archetype->components[c], transfer_remap(component_remap, archetype->components[c]))) {
+                return false;
+            }
+        }
+    }
+    for (comp_id_t s = 0; s < source->number_of_sparse_components; s++) {
+        if (!transfer_layouts_match(source, target, source->sparse_components[s], transfer_remap(component_remap, source->sparse_components[s]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//copies the table components of one source archetype's rows into the spawned target rows, one column at a time.
+//new_ids[r] took the r-th row of the ranges.
+static void world_transfer_columns(
+    World* target,
+    const Archetype* source_archetype,
+    const TransferRow* rows,
+    const id_t* new_ids,
+    const ChunkRange* ranges,
+    const chunks_length_t number_of_ranges,
+    const comp_id_t* component_remap)
+{
+    const Archetype* target_archetype = &target->archetypes[ranges[0].archetype_id];
+    for (comp_id_t c = 0; c < source_archetype->number_of_components; c++) {
+        const comp_id_t target_component = transfer_remap(component_remap, source_archetype->components[c]);
+        const ComponentData* component_data = &target->all_components_data[target_component];
+        const bool sparse = component_data->storage == COMPONENT_STORAGE_SPARSE;
+        const uint32_t target_column = sparse ? 0 : target_archetype->component_columns[archetype_component_index(target_archetype, target_component)];
+
+        for (comp_size_t f = 0; f < component_data->number_of_fields; f++) {
+            const size_t field_size = component_data->field_sizes[f];
+            const uint32_t source_column = source_archetype->component_columns[c] + f;
+            id_t r = 0;
+            for (chunks_length_t k = 0; k < number_of_ranges; k++) {
+                for (chunk_size_t row = ranges[k].begin; row < ranges[k].end; row++, r++) {
+                    const RowLocation* location = &rows[r].location;
+                    const uint8_t* source_array = source_archetype->chunks[location->chunk_index].columns[source_column];
+                    void* target_field = sparse
+                        ? world_get_sparse_field(target, new_ids[r], target_component, f)
+                        : (uint8_t*)target_archetype->chunks[ranges[k].chunk_index].columns[target_column + f] + row * field_size;
+                    row_copy_field(target_field, source_array + location->dense_id_array_index * field_size, field_size);
+                }
+            }
+        }
+    }
+}
+
+//the sparse components differ per entity, so they are added to the moved entity one by one
+static void world_transfer_sparse_rows(
+    const World* source,
+    World* target,
+    const TransferRow* rows,
+    const id_t* new_ids,
+    const id_t number_of_rows,
+    const comp_id_t* component_remap)
+{
+    for (comp_id_t s = 0; s < source->number_of_sparse_components; s++) {
+        const comp_id_t source_component = source->sparse_components[s];
+        const comp_id_t target_component = transfer_remap(component_remap, source_component);
+        const ComponentData* component_data = &source->all_components_data[source_component];
+
+        for (id_t r = 0; r < number_of_rows; r++) {
+            const id_t entity_id = rows[r].location.entity_id;
+            if (!component_set_find(&component_data->set, entity_id)) {
+                continue;
+            }
+            world_add_component(target, new_ids[r], target_component);
+            for (comp_size_t f = 0; f < component_data->number_of_fields; f++) {
+                row_copy_field(
+                    world_get_component_field(target, new_ids[r], target_component, f),
+                    world_get_sparse_field(source, entity_id, source_component, f),
+                    component_data->field_sizes[f]);
+            }
+        }
+    }
+}
+
+//the rows are grouped by source archetype, every group is spawned in one go in the target and copied
+//column by column. The source only releases the entities once everything has been copied.
+id_t world_transfer_entities(
+    World* source,
+    World* target,
+    const id_t* entity_ids,
+    const id_t number_of_entities,
+    const comp_id_t* component_remap,
+    id_t* out_ids)
+{
+    assert(source != target);
+    TransferRow* rows = malloc(sizeof(TransferRow) * (number_of_entities ? number_of_entities : 1));
+    if(!rows) exit(EXIT_FAILURE);
+
+    //stale handles are skipped
+    id_t number_of_rows = 0;
+    for (id_t i = 0; i < number_of_entities; i++) {
+        if (!world_is_alive(source, entity_ids[i])) {
+            continue;
+        }
+        TransferRow* row = &rows[number_of_rows];
+        row->location.entity_id = entity_ids[i];
+        world_locate_entity(source, entity_ids[i], &row->location.archetype_id, &row->location.chunk_index, &row->location.dense_id_array_index);
+        row->output_index = number_of_rows++;
+    }
+    if (number_of_rows == 0) {
+        free(rows);
+        return 0;
+    }
+    qsort(rows, number_of_rows, sizeof(TransferRow), compare_transfer_rows);
+    if (!transfer_remap_valid(source, target, rows, number_of_rows, component_remap)) {
+        free(rows);
+        return 0;
+    }
+
+    //an entity listed twice sorts next to itself, it moves once and both entries get its new id
+    const id_t number_of_listed = number_of_rows;
+    id_t* kept_rows = malloc(sizeof(id_t) * number_of_listed);
+    if(!kept_rows) exit(EXIT_FAILURE);
+    id_t* listed_outputs = malloc(sizeof(id_t) * number_of_listed);
+    if(!listed_outputs) exit(EXIT_FAILURE);
+    number_of_rows = 0;
+    for (id_t r = 0; r < number_of_listed; r++) {
+        listed_outputs[r] = rows[r].output_index;
+        if (number_of_rows == 0 || compare_row_locations(&rows[number_of_rows - 1].location, &rows[r].location) != 0) {
+            rows[number_of_rows++] = rows[r];
+        }
+        kept_rows[r] = number_of_rows - 1;
+    }
+
+    id_t* new_ids = malloc(sizeof(id_t) * number_of_rows);
+    if(!new_ids) exit(EXIT_FAILURE);
+    comp_id_t* target_components = malloc(sizeof(comp_id_t) * (source->number_of_components ? source->number_of_components : 1));
+    if(!target_components) exit(EXIT_FAILURE);
+
+    id_t i = 0;
+    while (i < number_of_rows) {
+        const Archetype* source_archetype = &source->archetypes[rows[i].location.archetype_id];
+        id_t end = i + 1;
+        while (end < number_of_rows && rows[end].location.archetype_id == rows[i].location.archetype_id) {
+            end++;
+        }
+
+        for (comp_id_t c = 0; c < source_archetype->number_of_components; c++) {
+            target_components[c] = transfer_remap(component_remap, source_archetype->components[c]);
+        }
+        const arch_id_t target_archetype_id = world_get_or_add_archetype(target, source_archetype->number_of_components, target_components);
+        ChunkRange* ranges = malloc(sizeof(ChunkRange) * (world_max_spawn_ranges(target, target_archetype_id, end - i) + 1));
+        if(!ranges) exit(EXIT_FAILURE);
+        const chunks_length_t number_of_ranges = world_add_entities_to_archetype(target, target_archetype_id, end - i, &new_ids[i], ranges);
+        for (id_t r = i; r < end; r++) {
+            world_insert_sparse_rows(target, new_ids[r], source_archetype->number_of_components, target_components);
+        }
+
+        world_transfer_columns(target, source_archetype, &rows[i], &new_ids[i], ranges, number_of_ranges, component_remap);
+        free(ranges);
+        world_transfer_sparse_rows(source, target, &rows[i], &new_ids[i], end - i, component_remap);
+        i = end;
+    }
+
+    //new_ids is reused for the source ids once the new ones are written out
+    if (out_ids) {
+        for (id_t r = 0; r < number_of_listed; r++) {
+            out_ids[listed_outputs[r]] = new_ids[kept_rows[r]];
+        }
+    }
+    for (id_t r = 0; r < number_of_rows; r++) {
+        new_ids[r] = rows[r].location.entity_id;
+    }
+    world_remove_entities(source, new_ids, number_of_rows);
+
+    free(listed_outputs);
+    free(kept_rows);
+    free(target_components);
+    free(new_ids);
+    free(rows);
+    return number_of_rows;
+}
+
+
+//Compaction Functions
+typedef struct ChunkFill {
+    chunk_size_t length;
+    chunks_length_t chunk_index;
+} ChunkFill;
+
+//fullest chunks first, ties keep the chunk order
+static int compare_chunk_fills(const void* a, const void* b) {
+    const ChunkFill* x = a;
+    const ChunkFill* y = b;
+    if (x->length != y->length) {
+        return x->length > y->length ? -1 : 1;
+    }
+    return (x->chunk_index > y->chunk_index) - (x->chunk_index < y->chunk_index);
+}
+
+//moves the last row of one chunk to the end of another chunk of the same archetype
+static void world_compact_move_row(World* world, Archetype* archetype, const chunks_length_t source_index, const chunks_length_t target_index) {
+    ArchetypeDataChunk* source = &archetype->chunks[source_index];
+    ArchetypeDataChunk* target = &archetype->chunks[target_index];
+    const chunk_size_t source_row = --source->dense_arrays_length;
+    const chunk_size_t target_row = target->dense_arrays_length++;
+
+    const id_t entity_id = source->id_dense_array[source_row];
+    target->id_dense_array[target_row] = entity_id;
+    archetype_copy_row(archetype, target, target_row, source, source_row);
+    world_touch_chunk(world, archetype, source_index);
+    world_touch_chunk(world, archetype, target_index);
+    world_set_entity_location(world, entity_id, archetype->archetype_id, target_index, target_row);
+}
+
+//frees the empty chunks, the last chunk takes the index of each freed one
+static bool world_release_empty_chunks(World* world, Archetype* archetype) {
+    bool released = false;
+    chunks_length_t c = 0;
+    while (c < archetype->number_of_chunks) {
+        if (archetype->chunks[c].dense_arrays_length > 0) {
+            c++;
+            continue;
+        }
+        archetype_data_chunk_destroy(&archetype->chunks[c], archetype, &world->chunk_pool);
+        released = true;
+
+        const chunks_length_t last = --archetype->number_of_chunks;
+        if (c != last) {
+            //different rows now live at index c
+            archetype->chunks[c] = archetype->chunks[last];
+            world_touch_chunk(world, archetype, c);
+            const ArchetypeDataChunk* chunk = &archetype->chunks[c];
+            for (chunk_size_t r = 0; r < chunk->dense_arrays_length; r++) {
+                world_set_entity_location(world, chunk->id_dense_array[r], archetype->archetype_id, c, r);
+            }
+        }
+    }
+    return released;
+}
+
+//drains the emptiest chunks into the fullest ones, moving at most *row_budget rows,
+//then frees the chunks left empty. Returns true once the archetype needs no more moves.
+static bool world_compact_archetype(World* world, const arch_id_t archetype_id, uint32_t* row_budget) {
+    Archetype* archetype = &world->archetypes[archetype_id];
+    const chunk_size_t chunk_size = archetype->chunk_size;
+
+    size_t number_of_rows = 0;
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        number_of_rows += archetype->chunks[c].dense_arrays_length;
+    }
+    //as many chunks as the rows need, so none of them can be empty
+    const chunks_length_t needed_chunks = (number_of_rows + chunk_size - 1) / chunk_size;
+    if (archetype->number_of_chunks == needed_chunks) {
+        return true;
+    }
+
+    ChunkFill* fills = malloc(sizeof(ChunkFill) * archetype->number_of_chunks);
+    if(!fills) exit(EXIT_FAILURE);
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        fills[c].length = archetype->chunks[c].dense_arrays_length;
+        fills[c].chunk_index = c;
+    }
+    qsort(fills, archetype->number_of_chunks, sizeof(ChunkFill), compare_chunk_fills);
+
+    //the first needed_chunks chunks in fill order receive the rows of all the others
+    chunks_length_t target = 0;
+    chunks_length_t source = archetype->number_of_chunks;
+    while (source > needed_chunks && *row_budget > 0) {
+        const chunks_length_t source_index = fills[source - 1].chunk_index;
+        if (archetype->chunks[source_index].dense_arrays_length == 0) {
+            source--;
+            continue;
+        }
+        const chunks_length_t target_index = fills[target].chunk_index;
+        if (archetype->chunks[target_index].dense_arrays_length == chunk_size) {
+            target++;
+            continue;
+        }
+        world_compact_move_row(world, archetype, source_index, target_index);
+        (*row_budget)--;
+    }
+    while (source > needed_chunks && archetype->chunks[fills[source - 1].chunk_index].dense_arrays_length == 0) {
+        source--;
+    }
+    free(fills);
+
+    if (world_release_empty_chunks(world, archetype)) {
+        for (query_id_t q = 0; q < world->number_of_queries; q++) {
+            if (query_has_archetype(&world->queries[q], archetype_id)) {
+                query_rebuild_chunks(&world->queries[q], world->archetypes);
+            }
+        }
+    }
+    archetype_rebuild_free_chunks(archetype);
+    return source == needed_chunks;
+}
+
+void world_compact(World* world) {
+    uint32_t row_budget = UINT32_MAX;
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        world_compact_archetype(world, a, &row_budget);
+    }
+    chunk_pool_trim(&world->chunk_pool);
+}
+
+bool world_compact_step(World* world, uint32_t row_budget) {
+    for (arch_id_t visited = 0; visited < world->number_of_archetypes; visited++) {
+        const arch_id_t archetype_id = world->compact_cursor % world->number_of_archetypes;
+        if (!world_compact_archetype(world, archetype_id, &row_budget)) {
+            //out of budget, the next step continues with this archetype
+            return false;
+        }
+        world->compact_cursor = (archetype_id + 1) % world->number_of_archetypes;
+    }
+    chunk_pool_trim(&world->chunk_pool);
+    return true;
+}
+
+
+//Sort Functions
+typedef struct SortRow {
+    uint64_t key;
+    //position among the archetype's rows, counted through the chunks in order
+    id_t slot;
+} SortRow;
+
+//key first, ties keep their current order so equal keys do not move
+static int compare_sort_rows(const void* a, const void* b) {
+    const SortRow* x = a;
+    const SortRow* y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+uint32_t world_add_sort_key(World* world, const SortKeyDesc* desc) {
+    assert(!world_is_sparse_component(world, desc->component));
+    assert(desc->function || desc->field < world->all_components_data[desc->component].number_of_fields);
+    world->sort_keys = realloc(world->sort_keys, sizeof(SortKeyDesc) * (world->number_of_sort_keys + 1));
+    if(!world->sort_keys) exit(EXIT_FAILURE);
+    world->sort_keys[world->number_of_sort_keys] = *desc;
+
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        Archetype* archetype = &world->archetypes[a];
+        if (archetype->sort_key == UINT32_MAX && component_mask_has(&archetype->mask, desc->component)) {
+            archetype->sort_key = world->number_of_sort_keys;
+        }
+    }
+    return world->number_of_sort_keys++;
+}
+
+static uint64_t archetype_row_key(
+    const Archetype* archetype,
+    const ArchetypeDataChunk* chunk,
+    const SortKeyDesc* key,
+    const uint32_t first_column,
+    const chunk_size_t row)
+{
+    if (key->function) {
+        return key->function(&chunk->columns[first_column], row, key->user_data);
+    }
+    const uint32_t column = first_column + key->field;
+    const void* field_array = chunk->columns[column];
+    switch (archetype->column_sizes[column]) {
+        case 1: return ((const uint8_t*)field_array)[row];
+        case 2: return ((const uint16_t*)field_array)[row];
+        case 4: return ((const uint32_t*)field_array)[row];
+        case 8: return ((const uint64_t*)field_array)[row];
+        default:
+            assert(false && "sort key fields need 1, 2, 4 or 8 bytes");
+            return 0;
+    }
+}
+
+//true only if the chunk's bounds are up to date and prove that no row has a key in [key_min, key_max]
+static bool world_chunk_outside_key_range(
+    const World* world,
+    const Archetype* archetype,
+    const ArchetypeDataChunk* chunk,
+    const uint32_t sort_key,
+    const uint64_t key_min,
+    const uint64_t key_max)
+{
+    if (archetype->sort_key != sort_key || chunk->bounds_tick == 0 ||
+        archetype_chunk_component_changed(archetype, chunk, world->sort_keys[sort_key].component, chunk->bounds_tick)) {
+        return false;
+    }
+    return chunk->key_max < key_min || chunk->key_min > key_max;
+}
+
+//rows dropped in a row before the last kept row counts as the outlier instead
+#define DROP_MERGE_RECENCY 8
+
+//sorts rows that are mostly in order already in about linear time: rows that break the order are set aside,
+//sorted on their own and merged back (drop-merge sort). Many out of order rows fall back to qsort.
+static void sort_rows_adaptive(SortRow* rows, const id_t number_of_rows) {
+    SortRow* kept = malloc(sizeof(SortRow) * (number_of_rows ? number_of_rows : 1));
+    if(!kept) exit(EXIT_FAILURE);
+    SortRow* dropped = malloc(sizeof(SortRow) * (number_of_rows ? number_of_rows : 1));
+    if(!dropped) exit(EXIT_FAILURE);
+
+    const id_t max_dropped = number_of_rows / 8;
+    id_t number_of_kept = 0;
+    id_t number_of_dropped = 0;
+    uint32_t dropped_in_row = 0;
+    for (id_t i = 0; i < number_of_rows && number_of_dropped <= max_dropped; i++) {
+        if (number_of_kept == 0 || compare_sort_rows(&rows[i], &kept[number_of_kept - 1]) >= 0) {
+            kept[number_of_kept++] = rows[i];
+            dropped_in_row = 0;
+        } else if (dropped_in_row == 0 && number_of_kept >= 2 && compare_sort_rows(&rows[i], &kept[number_of_kept - 2]) >= 0) {
+            //a single row that is too big, it goes and this one takes its place
+            dropped[number_of_dropped++] = kept[number_of_kept - 1];
+            kept[number_of_kept - 1] = rows[i];
+        } else if (dropped_in_row < DROP_MERGE_RECENCY) {
+            dropped[number_of_dropped++] = rows[i];
+            dropped_in_row++;
+        } else {
+            //take the run of drops back and drop the kept rows bigger than its first row instead
+            number_of_dropped -= dropped_in_row;
+            i -= dropped_in_row;
+            while (number_of_kept > 0 && compare_sort_rows(&rows[i], &kept[number_of_kept - 1]) < 0) {
+                dropped[number_of_dropped++] = kept[--number_of_kept];
+            }
+            kept[number_of_kept++] = rows[i];
+            dropped_in_row = 0;
+        }
+    }
+
+    if (number_of_dropped > max_dropped) {
+        qsort(rows, number_of_rows, sizeof(SortRow), compare_sort_rows);
+    } else {
+        qsort(dropped, number_of_dropped, sizeof(SortRow), compare_sort_rows);
+        id_t k = 0;
+        id_t d = 0;
+        for (id_t i = 0; i < number_of_rows; i++) {
+            if (d == number_of_dropped || (k < number_of_kept && compare_sort_rows(&kept[k], &dropped[d]) < 0)) {
+                rows[i] = kept[k++];
+            } else {
+                rows[i] = dropped[d++];
+            }
+        }
+    }
+    free(dropped);
+    free(kept);
+}
+
+#define SORT_GATHER(type)                                                                                   \
+    for (id_t i = begin; i < end; i++) {                                                                    \
+        const id_t source = rows[i].slot;                                                                   \
+        ((type*)scratch)[i] = ((const type*)column_of(archetype, slot_chunks[source], column))[slot_rows[source]]; \
+    }
+
+//the id array for column UINT32_MAX, the field array otherwise
+static void* column_of(const Archetype* archetype, const chunks_length_t chunk_index, const uint32_t column) {
+    const ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+    return column == UINT32_MAX ? (void*)chunk->id_dense_array : chunk->columns[column];
+}
+
+//moves every row to the slot rows[slot].slot says it comes from. Each column is gathered into a scratch array in
+//sorted order and copied back chunk by chunk. Chunks whose rows all stay are skipped, every chunk keeps its length
+//and block, so cached queries stay valid.
+static void world_sort_permute(World* world, Archetype* archetype, const SortRow* rows, const id_t number_of_rows,
+                               const chunks_length_t* slot_chunks, const chunk_size_t* slot_rows) {
+    id_t* chunk_begins = malloc(sizeof(id_t) * (archetype->number_of_chunks + 1));
+    if(!chunk_begins) exit(EXIT_FAILURE);
+    bool* moved = calloc(archetype->number_of_chunks ? archetype->number_of_chunks : 1, sizeof(bool));
+    if(!moved) exit(EXIT_FAILURE);
+    size_t widest = sizeof(id_t);
+    for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+        widest = archetype->column_sizes[column] > widest ? archetype->column_sizes[column] : widest;
+    }
+    uint8_t* scratch = malloc(widest * number_of_rows);
+    if(!scratch) exit(EXIT_FAILURE);
+
+    chunk_begins[0] = 0;
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        chunk_begins[c + 1] = chunk_begins[c] + archetype->chunks[c].dense_arrays_length;
+        for (id_t i = chunk_begins[c]; i < chunk_begins[c + 1] && !moved[c]; i++) {
+            moved[c] = rows[i].slot != i;
+        }
+    }
+
+    //UINT32_MAX is the id array, it goes last so the gathers above still find the old ids
+    for (uint32_t column = 0; ; column = column + 1 == archetype->number_of_columns ? UINT32_MAX : column + 1) {
+        if (archetype->number_of_columns == 0) {
+            column = UINT32_MAX;
+        }
+        const size_t size = column == UINT32_MAX ? sizeof(id_t) : archetype->column_sizes[column];
+        for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+            if (!moved[c]) {
+                continue;
+            }
+            const id_t begin = chunk_begins[c];
+            const id_t end = chunk_begins[c + 1];
+            switch (size) {
+                case 1: SORT_GATHER(uint8_t) break;
+                case 2: SORT_GATHER(uint16_t) break;
+                case 4: SORT_GATHER(uint32_t) break;
+                case 8: SORT_GATHER(uint64_t) break;
+                default:
+                    for (id_t i = begin; i < end; i++) {
+                        const id_t source = rows[i].slot;
+                        memcpy(scratch + i * size, (const uint8_t*)column_of(archetype, slot_chunks[source], column) + (size_t)slot_rows[source] * size, size);
+                    }
+            }
+        }
+        for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+            if (moved[c]) {
+                memcpy(column_of(archetype, c, column), scratch + chunk_begins[c] * size, (chunk_begins[c + 1] - chunk_begins[c]) * size);
+            }
+        }
+        if (column == UINT32_MAX) {
+            break;
+        }
+    }
+
+    //the moved entities are in random id order, so their sparse entries are prefetched ahead
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        if (!moved[c]) {
+            continue;
+        }
+        const ArchetypeDataChunk* chunk = &archetype->chunks[c];
+        for (chunk_size_t r = 0; r < chunk->dense_arrays_length; r++) {
+            if (r + BATCH_PREFETCH_DISTANCE < chunk->dense_arrays_length) {
+                PREFETCH(world_sparse_entry(world, chunk->id_dense_array[r + BATCH_PREFETCH_DISTANCE]));
+            }
+            if (rows[chunk_begins[c] + r].slot != chunk_begins[c] + r) {
+                world_set_entity_location(world, chunk->id_dense_array[r], archetype->archetype_id, c, r);
+            }
+        }
+        world_touch_chunk(world, archetype, c);
+    }
+
+    free(scratch);
+    free(moved);
+    free(chunk_begins);
+}
+
+static void world_sort_archetype(World* world, Archetype* archetype) {
+    const SortKeyDesc* key = &world->sort_keys[archetype->sort_key];
+    bool changed = false;
+    id_t number_of_rows = 0;
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        changed |= archetype_chunk_component_changed(archetype, &archetype->chunks[c], key->component, archetype->sort_tick);
+        number_of_rows += archetype->chunks[c].dense_arrays_length;
+    }
+    //order and bounds from the last sort still hold
+    if (!changed && archetype->sort_tick != 0) {
+        return;
+    }
+
+    const uint32_t first_column = archetype->component_columns[archetype_component_index(archetype, key->component)];
+    SortRow* rows = malloc(sizeof(SortRow) * (number_of_rows ? number_of_rows : 1));
+    if(!rows) exit(EXIT_FAILURE);
+    chunks_length_t* slot_chunks = malloc(sizeof(chunks_length_t) * (number_of_rows ? number_of_rows : 1));
+    if(!slot_chunks) exit(EXIT_FAILURE);
+    chunk_size_t* slot_rows = malloc(sizeof(chunk_size_t) * (number_of_rows ? number_of_rows : 1));
+    if(!slot_rows) exit(EXIT_FAILURE);
+
+    bool sorted = true;
+    id_t slot = 0;
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        const ArchetypeDataChunk* chunk = &archetype->chunks[c];
+        for (chunk_size_t r = 0; r < chunk->dense_arrays_length; r++) {
+            rows[slot].key = archetype_row_key(archetype, chunk, key, first_column, r);
+            rows[slot].slot = slot;
+            slot_chunks[slot] = c;
+            slot_rows[slot] = r;
+            sorted &= slot == 0 || rows[slot - 1].key <= rows[slot].key;
+            slot++;
+        }
+    }
+    if (!sorted) {
+        sort_rows_adaptive(rows, number_of_rows);
+        world_sort_permute(world, archetype, rows, number_of_rows, slot_chunks, slot_rows);
+    }
+
+    //rows are in key order through the chunks, so each chunk's bounds are its first and last key
+    slot = 0;
+    for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+        ArchetypeDataChunk* chunk = &archetype->chunks[c];
+        const chunk_size_t length = chunk->dense_arrays_length;
+        chunk->key_min = length ? rows[slot].key : UINT64_MAX;
+        chunk->key_max = length ? rows[slot + length - 1].key : 0;
+        chunk->bounds_tick = world->change_tick;
+        slot += length;
+    }
+    archetype->sort_tick = world->change_tick;
+
+    free(slot_rows);
+    free(slot_chunks);
+    free(rows);
+}
+
+uint32_t world_sort(World* world) {
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        if (world->archetypes[a].sort_key != UINT32_MAX) {
+            world_sort_archetype(world, &world->archetypes[a]);
+        }
+    }
+    //every later change gets a newer tick than the bounds, even changes this tick would otherwise hide
+    return world_advance_tick(world);
+}
+
+bool world_get_chunk_key_bounds(
+    const World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    uint64_t* out_key_min,
+    uint64_t* out_key_max)
+{
+    const Archetype* archetype = &world->archetypes[archetype_id];
+    const ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+    if (archetype->sort_key == UINT32_MAX || chunk->bounds_tick == 0 ||
+        archetype_chunk_component_changed(archetype, chunk, world->sort_keys[archetype->sort_key].component, chunk->bounds_tick)) {
+        return false;
+    }
+    *out_key_min = chunk->key_min;
+    *out_key_max = chunk->key_max;
+    return true;
+}
+
+//spreads the low bits of x so that two zero bits follow each of them
+static uint64_t morton_spread_3(uint32_t x) {
+    uint64_t v = x & 0x1FFFFF;
+    v = (v | v << 32) & 0x1F00000000FFFFull;
+    v = (v | v << 16) & 0x1F0000FF0000FFull;
+    v = (v | v << 8) & 0x100F00F00F00F00Full;
+    v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+static uint64_t morton_spread_2(uint32_t x) {
+    uint64_t v = x;
+    v = (v | v << 16) & 0x0000FFFF0000FFFFull;
+    v = (v | v << 8) & 0x00FF00FF00FF00FFull;
+    v = (v | v << 4) & 0x0F0F0F0F0F0F0F0Full;
+    v = (v | v << 2) & 0x3333333333333333ull;
+    v = (v | v << 1) & 0x5555555555555555ull;
+    return v;
+}
+
+uint64_t morton_code_2d(const uint32_t x, const uint32_t y) {
+    return morton_spread_2(x) | morton_spread_2(y) << 1;
+}
+
+uint64_t morton_code_3d(const uint32_t x, const uint32_t y, const uint32_t z) {
+    return morton_spread_3(x) | morton_spread_3(y) << 1 | morton_spread_3(z) << 2;
+}
+
+
+//Snapshot Functions
+#define SNAPSHOT_MAGIC 0x57534345u
+#define SNAPSHOT_VERSION 3u
+
+//everything a loader has to agree on comes first, the sections follow in the order they are written
+typedef struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t arch_id_bits;
+    uint8_t comp_id_bits;
+    uint8_t comp_size_bits;
+    uint8_t entity_index_bits;
+    uint32_t pointer_size;
+    uint32_t cache_size;
+    uint32_t max_components;
+    uint32_t dense_array_chunk_size;
+    uint32_t sparse_array_chunk_size;
+    uint64_t chunk_byte_budget;
+    uint32_t first_entity_index;
+    uint32_t number_of_entity_indexes;
+    uint32_t number_of_components;
+    uint32_t number_of_archetypes;
+    uint32_t sparse_array_number_of_chunks;
+    uint32_t id_stack_top_index;
+    uint32_t next_entity_slot;
+    uint32_t change_tick;
+} SnapshotHeader;
+
+typedef struct SnapshotComponent {
+    uint32_t number_of_fields;
+    uint32_t storage;
+} SnapshotComponent;
+
+typedef struct SnapshotSet {
+    uint32_t count;
+    uint32_t positions_capacity;
+} SnapshotSet;
+
+typedef struct SnapshotArchetype {
+    uint32_t number_of_components;
+    uint32_t chunk_size;
+    uint32_t number_of_chunks;
+    uint32_t padding;
+} SnapshotArchetype;
+
+typedef struct SnapshotChunk {
+    uint32_t length;
+    uint32_t structure_tick;
+} SnapshotChunk;
+
+typedef struct SnapshotWriter {
+    FILE* file;
+    size_t offset;
+    bool ok;
+} SnapshotWriter;
+
+static void snapshot_write(SnapshotWriter* writer, const void* data, const size_t size) {
+    if (size > 0 && writer->ok && fwrite(data, 1, size, writer->file) != size) {
+        writer->ok = false;
+    }
+    writer->offset += size;
+}
+
+//alignment is at most CACHE_SIZE
+static void snapshot_write_padding(SnapshotWriter* writer, const size_t alignment) {
+    static const uint8_t zeros[CACHE_SIZE] = {0};
+    snapshot_write(writer, zeros, (alignment - writer->offset % alignment) % alignment);
+}
+
+typedef struct SnapshotReader {
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+} SnapshotReader;
+
+//NULL once the data is too short
+static const void* snapshot_read(SnapshotReader* reader, const size_t size) {
+    if (size > reader->size - reader->offset) {
+        return NULL;
+    }
+    const void* data = reader->data + reader->offset;
+    reader->offset += size;
+    return data;
+}
+
+static bool snapshot_read_padding(SnapshotReader* reader, const size_t alignment) {
+    return snapshot_read(reader, (alignment - reader->offset % alignment) % alignment) != NULL;
+}
+
+static SnapshotHeader snapshot_header(const World* world) {
+    const SnapshotHeader header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .arch_id_bits = ARCH_ID_BITS,
+        .comp_id_bits = COMP_ID_BITS,
+        .comp_size_bits = COMP_SIZE_BITS,
+        .entity_index_bits = ENTITY_INDEX_BITS,
+        .pointer_size = sizeof(void*),
+        .cache_size = CACHE_SIZE,
+        .max_components = MAX_COMPONENTS,
+        .dense_array_chunk_size = world ? world->dense_array_chunk_size : 0,
+        .sparse_array_chunk_size = world ? world->sparse_array_chunk_size : 0,
+        .chunk_byte_budget = world ? world->chunk_byte_budget : 0,
+        .first_entity_index = world ? world->first_entity_index : 0,
+        .number_of_entity_indexes = world ? world->number_of_entity_indexes : 0,
+        .number_of_components = world ? world->number_of_components : 0,
+        .number_of_archetypes = world ? world->number_of_archetypes : 0,
+        .sparse_array_number_of_chunks = world ? world->sparse_array_number_of_chunks : 0,
+        .id_stack_top_index = world ? world->id_stack_top_index : 0,
+        .next_entity_slot = world ? world->next_entity_slot : 0,
+        .change_tick = world ? world->change_tick : 0
+    };
+    return header;
+}
+
+//the layout of the chunk blocks depends on all of these
+static bool snapshot_header_matches(const SnapshotHeader* header) {
+    const SnapshotHeader expected = snapshot_header(NULL);
+    return header->magic == expected.magic &&
+           header->version == expected.version &&
+           header->arch_id_bits == expected.arch_id_bits &&
+           header->comp_id_bits == expected.comp_id_bits &&
+           header->comp_size_bits == expected.comp_size_bits &&
+           header->entity_index_bits == expected.entity_index_bits &&
+           header->pointer_size == expected.pointer_size &&
+           header->cache_size == expected.cache_size &&
+           header->max_components == expected.max_components &&
+           header->id_stack_top_index <= header->next_entity_slot &&
+           header->first_entity_index <= ENTITY_INDEX_MASK &&
+           header->number_of_entity_indexes > 0 &&
+           header->number_of_entity_indexes <= ENTITY_INDEX_MASK + 1 - header->first_entity_index &&
+           header->next_entity_slot <= header->number_of_entity_indexes &&
+           header->sparse_array_chunk_size > 0;
+}
+
+bool world_save(const World* world, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    SnapshotWriter writer = { .file = file, .offset = 0, .ok = true };
+
+    const SnapshotHeader header = snapshot_header(world);
+    snapshot_write(&writer, &header, sizeof(SnapshotHeader));
+
+    //component types, a sparse component is followed by its set
+    for (comp_id_t c = 0; c < world->number_of_components; c++) {
+        const ComponentData* component_data = &world->all_components_data[c];
+        const SnapshotComponent component = { .number_of_fields = component_data->number_of_fields, .storage = component_data->storage };
+        snapshot_write(&writer, &component, sizeof(SnapshotComponent));
+        snapshot_write(&writer, component_data->field_sizes, sizeof(comp_size_t) * component_data->number_of_fields);
+        snapshot_write_padding(&writer, sizeof(uint64_t));
+        if (component_data->storage != COMPONENT_STORAGE_SPARSE) {
+            continue;
+        }
+        const ComponentSet* set = &component_data->set;
+        const SnapshotSet set_record = { .count = set->count, .positions_capacity = set->positions_capacity };
+        snapshot_write(&writer, &set_record, sizeof(SnapshotSet));
+        snapshot_write(&writer, set->positions, sizeof(id_t) * set->positions_capacity);
+        snapshot_write(&writer, set->ids, sizeof(id_t) * set->count);
+        for (comp_size_t f = 0; f < component_data->number_of_fields; f++) {
+            snapshot_write_padding(&writer, sizeof(uint64_t));
+            snapshot_write(&writer, set->fields[f], (size_t)component_data->field_sizes[f] * set->count);
+        }
+        snapshot_write_padding(&writer, sizeof(uint64_t));
+    }
+
+    //archetypes, the chunk blocks are written as they are so a loader can use them in place
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        const Archetype* archetype = &world->archetypes[a];
+        const SnapshotArchetype record = {
+            .number_of_components = archetype->number_of_components,
+            .chunk_size = archetype->chunk_size,
+            .number_of_chunks = archetype->number_of_chunks,
+            .padding = 0
+        };
+        snapshot_write(&writer, &record, sizeof(SnapshotArchetype));
+        snapshot_write(&writer, archetype->components, sizeof(comp_id_t) * archetype->number_of_components);
+        snapshot_write_padding(&writer, sizeof(uint64_t));
+        for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+            const SnapshotChunk chunk = { .length = archetype->chunks[ch].dense_arrays_length, .structure_tick = archetype->chunks[ch].structure_tick };
+            snapshot_write(&writer, &chunk, sizeof(SnapshotChunk));
+        }
+        snapshot_write_padding(&writer, CACHE_SIZE);
+        for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+            snapshot_write(&writer, archetype->chunks[ch].block, archetype->chunk_block_size);
+        }
+    }
+
+    //one byte per directory entry tells whether its page follows
+    for (chunks_length_t c = 0; c < world->sparse_array_number_of_chunks; c++) {
+        const uint8_t present = world->sparse_array_chunks[c].entries != NULL;
+        snapshot_write(&writer, &present, sizeof(uint8_t));
+    }
+    snapshot_write_padding(&writer, sizeof(uint64_t));
+    for (chunks_length_t c = 0; c < world->sparse_array_number_of_chunks; c++) {
+        if (world->sparse_array_chunks[c].entries) {
+            snapshot_write(&writer, world->sparse_array_chunks[c].entries, sizeof(SparseEntry) * world->sparse_array_chunk_size);
+        }
+    }
+    snapshot_write(&writer, world->id_stack_ids, sizeof(id_t) * world->id_stack_top_index);
+
+    bool ok = writer.ok;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+static bool world_load_component_set(World* world, SnapshotReader* reader, const comp_id_t component_id) {
+    ComponentData* component_data = &world->all_components_data[component_id];
+    ComponentSet* set = &component_data->set;
+    const SnapshotSet* record = snapshot_read(reader, sizeof(SnapshotSet));
+    if (!record) {
+        return false;
+    }
+    const void* positions = snapshot_read(reader, sizeof(id_t) * record->positions_capacity);
+    const void* ids = snapshot_read(reader, sizeof(id_t) * record->count);
+    if (!positions || !ids) {
+        return false;
+    }
+
+    set->positions = malloc(sizeof(id_t) * record->positions_capacity);
+    if(!set->positions && record->positions_capacity) exit(EXIT_FAILURE);
+    memcpy(set->positions, positions, sizeof(id_t) * record->positions_capacity);
+    set->positions_capacity = record->positions_capacity;
+    set->ids = malloc(sizeof(id_t) * record->count);
+    if(!set->ids && record->count) exit(EXIT_FAILURE);
+    memcpy(set->ids, ids, sizeof(id_t) * record->count);
+    set->count = record->count;
+    set->capacity = record->count;
+
+    for (comp_size_t f = 0; f < component_data->number_of_fields; f++) {
+        const size_t size = (size_t)component_data->field_sizes[f] * record->count;
+        const void* field = snapshot_read_padding(reader, sizeof(uint64_t)) ? snapshot_read(reader, size) : NULL;
+        if (!field) {
+            return false;
+        }
+        set->fields[f] = malloc(size);
+        if(!set->fields[f] && size) exit(EXIT_FAILURE);
+        memcpy(set->fields[f], field, size);
+    }
+    return snapshot_read_padding(reader, sizeof(uint64_t));
+}
+
+//points the archetype's chunks at the blocks in the mapping, only their column tables are rewritten
+static bool world_load_archetype(World* world, SnapshotReader* reader) {
+    const SnapshotArchetype* record = snapshot_read(reader, sizeof(SnapshotArchetype));
+    if (!record || record->number_of_components > world->number_of_components) {
+        return false;
+    }
+    const comp_id_t* components = snapshot_read(reader, sizeof(comp_id_t) * record->number_of_components);
+    if (!components || !snapshot_read_padding(reader, sizeof(uint64_t))) {
+        return false;
+    }
+    //archetype components are sorted table components
+    for (uint32_t c = 0; c < record->number_of_components; c++) {
+        if (components[c] >= world->number_of_components || (c > 0 && components[c - 1] >= components[c]) ||
+            world_is_sparse_component(world, components[c])) {
+            return false;
+        }
+    }
+    //a second archetype with the same signature would shadow the first in the lookup
+    ComponentMask mask;
+    component_mask_init(&mask, components, record->number_of_components);
+    arch_id_t existing;
+    if (world_match_archetype(world, &mask, &existing)) {
+        return false;
+    }
+
+    const arch_id_t archetype_id = world_add_archetype(world, record->number_of_components, components, 0);
+    Archetype* archetype = &world->archetypes[archetype_id];
+    const SnapshotChunk* chunks = snapshot_read(reader, sizeof(SnapshotChunk) * record->number_of_chunks);
+    if (archetype->chunk_size != record->chunk_size || !chunks || !snapshot_read_padding(reader, CACHE_SIZE)) {
+        return false;
+    }
+    //the mapping is writable, copy-on-write
+    uint8_t* blocks = (uint8_t*)snapshot_read(reader, archetype->chunk_block_size * record->number_of_chunks);
+    if (!blocks) {
+        return false;
+    }
+
+    archetype_reserve_chunks(archetype, record->number_of_chunks);
+    for (chunks_length_t ch = 0; ch < record->number_of_chunks; ch++) {
+        if (chunks[ch].length > archetype->chunk_size) {
+            return false;
+        }
+        ArchetypeDataChunk* chunk = &archetype->chunks[archetype->number_of_chunks++];
+        archetype_data_chunk_carve(chunk, blocks + ch * archetype->chunk_block_size, archetype);
+        chunk->dense_arrays_length = chunks[ch].length;
+        chunk->structure_tick = chunks[ch].structure_tick;
+        chunk->bounds_tick = 0;
+        chunk->key_min = UINT64_MAX;
+        chunk->key_max = 0;
+    }
+    archetype_rebuild_free_chunks(archetype);
+    return true;
+}
+
+//every live sparse entry has to point at a row holding its id, every row needs such an entry,
+//and the id stack may only hold used slots that are free, each once
+static bool world_loaded_entities_valid(const World* world) {
+    id_t number_of_rows = 0;
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        for (chunks_length_t c = 0; c < world->archetypes[a].number_of_chunks; c++) {
+            number_of_rows += world->archetypes[a].chunks[c].dense_arrays_length;
+        }
+    }
+
+    id_t number_of_live = 0;
+    for (chunks_length_t page = 0; page < world->sparse_array_number_of_chunks; page++) {
+        const SparseEntry* entries = world->sparse_array_chunks[page].entries;
+        if (!entries) {
+            continue;
+        }
+        for (id_t e = 0; e < world->sparse_array_chunk_size; e++) {
+            const SparseEntry* entry = &entries[e];
+            if (entry->archetype == ARCH_ID_INVALID) {
+                continue;
+            }
+            const id_t slot = ((id_t)page << world->sparse_array_chunk_shift) | e;
+            if (slot >= world->next_entity_slot || entry->archetype >= world->number_of_archetypes) {
+                return false;
+            }
+            const Archetype* archetype = &world->archetypes[entry->archetype];
+            if (entry->chunk_index >= archetype->number_of_chunks) {
+                return false;
+            }
+            const ArchetypeDataChunk* chunk = &archetype->chunks[entry->chunk_index];
+            if (entry->dense_id_array_index >= chunk->dense_arrays_length ||
+                chunk->id_dense_array[entry->dense_id_array_index] != ENTITY_ID(world->first_entity_index + slot, entry->generation)) {
+                return false;
+            }
+            number_of_live++;
+        }
+    }
+    //each live entry owns a different row, so equal counts leave no row without an entry
+    if (number_of_live != number_of_rows) {
+        return false;
+    }
+
+    uint8_t* listed = calloc(world->next_entity_slot ? world->next_entity_slot : 1, sizeof(uint8_t));
+    if(!listed) exit(EXIT_FAILURE);
+    bool valid = true;
+    for (id_t i = 0; i < world->id_stack_top_index && valid; i++) {
+        const id_t slot = world->id_stack_ids[i] - world->first_entity_index;
+        const SparseEntry* entry = slot < world->next_entity_slot ? world_find_sparse_entry(world, world->id_stack_ids[i]) : NULL;
+        valid = ENTITY_INDEX(world->id_stack_ids[i]) == world->id_stack_ids[i] &&
+            entry && entry->archetype == ARCH_ID_INVALID && !listed[slot];
+        if (valid) {
+            listed[slot] = 1;
+        }
+    }
+    free(listed);
+    return valid;
+}
+
+static bool world_load_sections(World* world, SnapshotReader* reader, const SnapshotHeader* header) {
+    for (uint32_t c = 0; c < header->number_of_components; c++) {
+        const SnapshotComponent* component = snapshot_read(reader, sizeof(SnapshotComponent));
+        if (!component || component->storage > COMPONENT_STORAGE_SPARSE || (uint32_t)world->number_of_components + 1 >= MAX_COMPONENTS) {
+            return false;
+        }
+        const comp_size_t* field_sizes = snapshot_read(reader, sizeof(comp_size_t) * component->number_of_fields);
+        if (!field_sizes || !snapshot_read_padding(reader, sizeof(uint64_t))) {
+            return false;
+        }
+        const comp_id_t component_id = world_add_component_type_with_storage(
+            world, field_sizes, (comp_size_t)component->number_of_fields, (ComponentStorage)component->storage);
+        if (component->storage == COMPONENT_STORAGE_SPARSE && !world_load_component_set(world, reader, component_id)) {
+            return false;
+        }
+    }
+
+    for (uint32_t a = 0; a < header->number_of_archetypes; a++) {
+        if (a >= ARCH_ID_INVALID || !world_load_archetype(world, reader)) {
+            return false;
+        }
+    }
+
+    world_reserve_sparse_directory(world, header->sparse_array_number_of_chunks);
+    const uint8_t* present = snapshot_read(reader, sizeof(uint8_t) * header->sparse_array_number_of_chunks);
+    if (!present || !snapshot_read_padding(reader, sizeof(uint64_t))) {
+        return false;
+    }
+    for (chunks_length_t c = 0; c < world->sparse_array_number_of_chunks; c++) {
+        if (!present[c]) {
+            continue;
+        }
+        const void* entries = snapshot_read(reader, sizeof(SparseEntry) * world->sparse_array_chunk_size);
+        if (!entries) {
+            return false;
+        }
+        sparse_array_chunk_init(&world->sparse_array_chunks[c], world->sparse_array_chunk_size);
+        memcpy(world->sparse_array_chunks[c].entries, entries, sizeof(SparseEntry) * world->sparse_array_chunk_size);
+    }
+
+    const id_t* ids = snapshot_read(reader, sizeof(id_t) * header->id_stack_top_index);
+    if (!ids) {
+        return false;
+    }
+    if (header->id_stack_top_index) {
+        world_reserve_id_stack(world, header->id_stack_top_index);
+        memcpy(world->id_stack_ids, ids, sizeof(id_t) * header->id_stack_top_index);
+    }
+    world->id_stack_top_index = header->id_stack_top_index;
+    world->next_entity_slot = header->next_entity_slot;
+    world->change_tick = header->change_tick;
+    return world_loaded_entities_valid(world);
+}
+
+bool world_load(World* out_world, const char* path, const ChunkAllocator* chunk_allocator) {
+    size_t size = 0;
+    uint8_t* data = snapshot_map(path, &size);
+    if (!data) {
+        return false;
+    }
+    SnapshotReader reader = { .data = data, .size = size, .offset = 0 };
+    const SnapshotHeader* header = snapshot_read(&reader, sizeof(SnapshotHeader));
+    if (!header || !snapshot_header_matches(header)) {
+        snapshot_unmap(data, size);
+        return false;
+    }
+
+    const WorldConfig config = {
+        .dense_array_chunk_size = header->dense_array_chunk_size,
+        .sparse_array_chunk_size = header->sparse_array_chunk_size,
+        .starting_sparse_array_chunks = header->sparse_array_number_of_chunks,
+        .chunk_byte_budget = header->chunk_byte_budget,
+        .chunk_allocator = chunk_allocator,
+        .first_entity_index = header->first_entity_index,
+        .number_of_entity_indexes = header->number_of_entity_indexes
+    };
+    World world = world_create_with_config(&config);
+    //from here on world_destroy unmaps the file
+    world.mapping = data;
+    world.mapping_size = size;
+    world.chunk_pool.foreign_begin = data;
+    world.chunk_pool.foreign_end = data + size;
+
+    if (world.sparse_array_chunk_size != header->sparse_array_chunk_size || !world_load_sections(&world, &reader, header)) {
+        world_destroy(&world);
+        return false;
+    }
+    //World has const members, so it is copied rather than assigned
+    memcpy(out_world, &world, sizeof(World));
+    return true;
+}
+
+
+//Delta Functions
+#define DELTA_MAGIC 0x44534345u
+//number_of_columns of a chunk record that carries the ids and every column
+#define DELTA_WHOLE_CHUNK UINT32_MAX
+
+typedef struct DeltaHeader {
+    uint32_t magic;
+    uint32_t since_tick;
+    uint32_t tick;
+    uint32_t number_of_archetypes;
+} DeltaHeader;
+
+//followed by the components, then the chunk records
+typedef struct DeltaArchetype {
+    uint32_t number_of_components;
+    uint32_t number_of_columns;
+    uint32_t chunk_size;
+    uint32_t number_of_chunks;
+    uint32_t number_of_chunk_records;
+} DeltaArchetype;
+
+//a whole chunk is followed by its ids and every column, otherwise by number_of_columns
+//pairs of a column index and the column's rows
+typedef struct DeltaChunk {
+    uint32_t chunk_index;
+    uint32_t length;
+    uint32_t number_of_columns;
+} DeltaChunk;
+
+DeltaBuffer delta_buffer_create(void) {
+    DeltaBuffer this = { .data = NULL, .size = 0, .capacity = 0 };
+    return this;
+}
+
+void delta_buffer_destroy(DeltaBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+static void delta_buffer_write(DeltaBuffer* buffer, const void* data, const size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (buffer->size + size > capacity) {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        if(!buffer->data) exit(EXIT_FAILURE);
+        buffer->capacity = capacity;
+    }
+    if (size > 0) {
+        memcpy(buffer->data + buffer->size, data, size);
+    }
+    buffer->size += size;
+}
+
+//delta records are not aligned, so they are copied out
+static bool snapshot_read_copy(SnapshotReader* reader, void* out, const size_t size) {
+    const void* data = snapshot_read(reader, size);
+    if (!data) {
+        return false;
+    }
+    memcpy(out, data, size);
+    return true;
+}
+
+static bool delta_chunk_changed(const Archetype* archetype, const ArchetypeDataChunk* chunk, const uint32_t since_tick) {
+    if (chunk->structure_tick > since_tick) {
+        return true;
+    }
+    for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+        if (chunk->column_ticks[column] > since_tick) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void world_write_delta(const World* world, const uint32_t since_tick, DeltaBuffer* buffer) {
+    buffer->size = 0;
+    const DeltaHeader header = {
+        .magic = DELTA_MAGIC,
+        .since_tick = since_tick,
+        .tick = world->change_tick,
+        .number_of_archetypes = world->number_of_archetypes
+    };
+    delta_buffer_write(buffer, &header, sizeof(DeltaHeader));
+
+    //every archetype is listed so the replica can follow its chunk count
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        const Archetype* archetype = &world->archetypes[a];
+        DeltaArchetype record = {
+            .number_of_components = archetype->number_of_components,
+            .number_of_columns = archetype->number_of_columns,
+            .chunk_size = archetype->chunk_size,
+            .number_of_chunks = archetype->number_of_chunks,
+            .number_of_chunk_records = 0
+        };
+        for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+            record.number_of_chunk_records += delta_chunk_changed(archetype, &archetype->chunks[ch], since_tick);
+        }
+        delta_buffer_write(buffer, &record, sizeof(DeltaArchetype));
+        delta_buffer_write(buffer, archetype->components, sizeof(comp_id_t) * archetype->number_of_components);
+
+        for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+            const ArchetypeDataChunk* chunk = &archetype->chunks[ch];
+            if (!delta_chunk_changed(archetype, chunk, since_tick)) {
+                continue;
+            }
+            const chunk_size_t length = chunk->dense_arrays_length;
+            DeltaChunk chunk_record = { .chunk_index = ch, .length = length, .number_of_columns = DELTA_WHOLE_CHUNK };
+
+            //rows moved, so every column is sent along with the ids
+            if (chunk->structure_tick > since_tick) {
+                delta_buffer_write(buffer, &chunk_record, sizeof(DeltaChunk));
+                delta_buffer_write(buffer, chunk->id_dense_array, sizeof(id_t) * length);
+                for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+                    delta_buffer_write(buffer, chunk->columns[column], (size_t)archetype->column_sizes[column] * length);
+                }
+                continue;
+            }
+
+            chunk_record.number_of_columns = 0;
+            for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+                chunk_record.number_of_columns += chunk->column_ticks[column] > since_tick;
+            }
+            delta_buffer_write(buffer, &chunk_record, sizeof(DeltaChunk));
+            for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+                if (chunk->column_ticks[column] > since_tick) {
+                    delta_buffer_write(buffer, &column, sizeof(uint32_t));
+                    delta_buffer_write(buffer, chunk->columns[column], (size_t)archetype->column_sizes[column] * length);
+                }
+            }
+        }
+    }
+}
+
+//ids of the rows a delta overwrote or dropped, the ones found nowhere afterwards were removed by the sender
+typedef struct DeltaVacated {
+    id_t* ids;
+    size_t count;
+    size_t capacity;
+} DeltaVacated;
+
+static void delta_vacated_push(DeltaVacated* vacated, const id_t* ids, const size_t number_of_ids) {
+    if (number_of_ids == 0) {
+        return;
+    }
+    if (vacated->count + number_of_ids > vacated->capacity) {
+        size_t capacity = vacated->capacity ? vacated->capacity : 256;
+        while (vacated->count + number_of_ids > capacity) {
+            capacity *= 2;
+        }
+        vacated->ids = realloc(vacated->ids, sizeof(id_t) * capacity);
+        if(!vacated->ids) exit(EXIT_FAILURE);
+        vacated->capacity = capacity;
+    }
+    memcpy(&vacated->ids[vacated->count], ids, sizeof(id_t) * number_of_ids);
+    vacated->count += number_of_ids;
+}
+
+//replaces a chunk's rows with the sender's, the new rows get their sparse entries
+static bool world_apply_delta_whole_chunk(
+    World* replica,
+    SnapshotReader* reader,
+    Archetype* archetype,
+    const DeltaChunk* chunk_record,
+    DeltaVacated* vacated)
+{
+    ArchetypeDataChunk* chunk = &archetype->chunks[chunk_record->chunk_index];
+    const id_t* ids = snapshot_read(reader, sizeof(id_t) * chunk_record->length);
+    if (!ids) {
+        return false;
+    }
+    delta_vacated_push(vacated, chunk->id_dense_array, chunk->dense_arrays_length);
+    memcpy(chunk->id_dense_array, ids, sizeof(id_t) * chunk_record->length);
+    chunk->dense_arrays_length = chunk_record->length;
+    world_touch_chunk(replica, archetype, chunk_record->chunk_index);
+
+    for (uint32_t column = 0; column < archetype->number_of_columns; column++) {
+        const size_t size = (size_t)archetype->column_sizes[column] * chunk_record->length;
+        const void* rows = snapshot_read(reader, size);
+        if (!rows) {
+            return false;
+        }
+        memcpy(chunk->columns[column], rows, size);
+        chunk->column_ticks[column] = replica->change_tick;
+    }
+
+    for (chunk_size_t row = 0; row < chunk_record->length; row++) {
+        const id_t entity_id = chunk->id_dense_array[row];
+        //the sender's index range has to lie inside the replica's
+        if (world_entity_slot(replica, entity_id) >= replica->number_of_entity_indexes) {
+            return false;
+        }
+        world_reserve_sparse_page(replica, world_entity_slot(replica, entity_id));
+        SparseEntry* entry = world_sparse_entry(replica, entity_id);
+        entry->archetype = archetype->archetype_id;
+        entry->chunk_index = chunk_record->chunk_index;
+        entry->dense_id_array_index = row;
+        entry->generation = ENTITY_GENERATION(entity_id);
+    }
+    return true;
+}
+
+static bool world_apply_delta_columns(World* replica, SnapshotReader* reader, Archetype* archetype, const DeltaChunk* chunk_record) {
+    ArchetypeDataChunk* chunk = &archetype->chunks[chunk_record->chunk_index];
+    if (chunk_record->length != chunk->dense_arrays_length) {
+        return false;
+    }
+    for (uint32_t c = 0; c < chunk_record->number_of_columns; c++) {
+        uint32_t column;
+        if (!snapshot_read_copy(reader, &column, sizeof(uint32_t)) || column >= archetype->number_of_columns) {
+            return false;
+        }
+        const size_t size = (size_t)archetype->column_sizes[column] * chunk_record->length;
+        const void* rows = snapshot_read(reader, size);
+        if (!rows) {
+            return false;
+        }
+        memcpy(chunk->columns[column], rows, size);
+        chunk->column_ticks[column] = replica->change_tick;
+    }
+    return true;
+}
+
+static bool world_apply_delta_archetype(World* replica, SnapshotReader* reader, DeltaVacated* vacated) {
+    DeltaArchetype record;
+    comp_id_t components[MAX_COMPONENTS];
+    if (!snapshot_read_copy(reader, &record, sizeof(DeltaArchetype)) || record.number_of_components > replica->number_of_components ||
+        !snapshot_read_copy(reader, components, sizeof(comp_id_t) * record.number_of_components)) {
+        return false;
+    }
+    for (uint32_t c = 0; c < record.number_of_components; c++) {
+        if (components[c] >= replica->number_of_components || world_is_sparse_component(replica, components[c])) {
+            return false;
+        }
+    }
+
+    const arch_id_t archetype_id = world_get_or_add_archetype(replica, record.number_of_components, components);
+    Archetype* archetype = &replica->archetypes[archetype_id];
+    if (archetype->number_of_components != record.number_of_components ||
+        archetype->number_of_columns != record.number_of_columns ||
+        archetype->chunk_size != record.chunk_size) {
+        return false;
+    }
+
+    //same chunk count as the sender, the rows of dropped chunks may have been removed
+    while (archetype->number_of_chunks < record.number_of_chunks) {
+        world_on_chunk_added(replica, archetype_id, archetype_add_chunk(archetype, &replica->chunk_pool));
+    }
+    if (archetype->number_of_chunks > record.number_of_chunks) {
+        while (archetype->number_of_chunks > record.number_of_chunks) {
+            ArchetypeDataChunk* chunk = &archetype->chunks[--archetype->number_of_chunks];
+            delta_vacated_push(vacated, chunk->id_dense_array, chunk->dense_arrays_length);
+            archetype_data_chunk_destroy(chunk, archetype, &replica->chunk_pool);
+        }
+        for (query_id_t q = 0; q < replica->number_of_queries; q++) {
+            if (query_has_archetype(&replica->queries[q], archetype_id)) {
+                query_rebuild_chunks(&replica->queries[q], replica->archetypes);
+            }
+        }
+    }
+
+    bool ok = true;
+    for (uint32_t r = 0; r < record.number_of_chunk_records && ok; r++) {
+        DeltaChunk chunk_record;
+        if (!snapshot_read_copy(reader, &chunk_record, sizeof(DeltaChunk)) ||
+            chunk_record.chunk_index >= archetype->number_of_chunks || chunk_record.length > archetype->chunk_size) {
+            ok = false;
+        } else if (chunk_record.number_of_columns == DELTA_WHOLE_CHUNK) {
+            ok = world_apply_delta_whole_chunk(replica, reader, archetype, &chunk_record, vacated);
+        } else {
+            ok = world_apply_delta_columns(replica, reader, archetype, &chunk_record);
+        }
+    }
+    archetype_rebuild_free_chunks(archetype);
+    return ok;
+}
+
+bool world_apply_delta(World* replica, const void* data, const size_t size) {
+    SnapshotReader reader = { .data = data, .size = size, .offset = 0 };
+    DeltaHeader header;
+    if (!snapshot_read_copy(&reader, &header, sizeof(DeltaHeader)) || header.magic != DELTA_MAGIC) {
+        return false;
+    }
+
+    DeltaVacated vacated = { .ids = NULL, .count = 0, .capacity = 0 };
+    bool ok = true;
+    for (uint32_t a = 0; a < header.number_of_archetypes && ok; a++) {
+        ok = world_apply_delta_archetype(replica, &reader, &vacated);
+    }
+
+    //an entity whose sparse entry no longer leads back to it is gone on the sender
+    for (size_t i = 0; i < vacated.count; i++) {
+        const id_t entity_id = vacated.ids[i];
+        SparseEntry* entry = world_sparse_entry(replica, entity_id);
+        if (entry->archetype == ARCH_ID_INVALID || entry->generation != ENTITY_GENERATION(entity_id)) {
+            continue;
+        }
+        const Archetype* archetype = &replica->archetypes[entry->archetype];
+        const bool stayed = entry->chunk_index < archetype->number_of_chunks &&
+            entry->dense_id_array_index < archetype->chunks[entry->chunk_index].dense_arrays_length &&
+            archetype->chunks[entry->chunk_index].id_dense_array[entry->dense_id_array_index] == entity_id;
+        if (!stayed) {
+            world_remove_all_sparse_rows(replica, entity_id);
+            entry->archetype = ARCH_ID_INVALID;
+        }
+    }
+    free(vacated.ids);
+    return ok;
+}
+
+
+//Spawn Phase Functions
+//stages reserve id stack positions in blocks of this many
+#define SPAWN_ID_BLOCK_SIZE 256
+
+//the staged chunks of one component list
+typedef struct SpawnGroup {
+    ComponentMask mask;
+    //every component of the mask, the sparse ones get their rows when the group is published
+    comp_id_t* components;
+    comp_id_t number_of_components;
+    //built like the world's archetype with the table components, its chunks are the staging chunks
+    Archetype archetype;
+} SpawnGroup;
+
+typedef struct SpawnStage {
+    SpawnGroup** groups;
+    uint32_t number_of_groups;
+    //positions of the reserved block that are not used yet
+    id_t block_next;
+    id_t block_end;
+} SpawnStage;
+
+struct SpawnPhase {
+    const World* world;
+    SpawnStage** stages;
+    uint32_t number_of_stages;
+    //positions count the released indexes from the top of the stack down, then the fresh ones in order
+    _Atomic id_t cursor;
+    id_t number_of_positions;
+};
+
+//the index at a position of the order world_pop_ids takes them in
+static id_t world_free_index(const World* world, const id_t position) {
+    if (position < world->id_stack_top_index) {
+        return world->id_stack_ids[world->id_stack_top_index - 1 - position];
+    }
+    return world->first_entity_index + world->next_entity_slot + (position - world->id_stack_top_index);
+}
+
+//slots without a page were never used and still have generation 0
+static generation_t world_index_generation(const World* world, const id_t index) {
+    const SparseEntry* entry = world_find_sparse_entry(world, index);
+    return entry ? entry->generation : 0;
+}
+
+SpawnPhase* world_begin_spawn_phase(World* world, const uint32_t number_of_stages) {
+    SpawnPhase* phase = malloc(sizeof(SpawnPhase));
+    if(!phase) exit(EXIT_FAILURE);
+    phase->world = world;
+    phase->number_of_stages = number_of_stages;
+    atomic_init(&phase->cursor, 0);
+    phase->number_of_positions = world->id_stack_top_index + (world->number_of_entity_indexes - world->next_entity_slot);
+
+    //one allocation per stage keeps the stages of different threads apart
+    phase->stages = malloc(sizeof(SpawnStage*) * (number_of_stages ? number_of_stages : 1));
+    if(!phase->stages) exit(EXIT_FAILURE);
+    for (uint32_t s = 0; s < number_of_stages; s++) {
+        SpawnStage* stage = malloc(sizeof(SpawnStage));
+        if(!stage) exit(EXIT_FAILURE);
+        stage->groups = NULL;
+        stage->number_of_groups = 0;
+        stage->block_next = 0;
+        stage->block_end = 0;
+        phase->stages[s] = stage;
+    }
+    return phase;
+}
+
+//the world is only read, so the stack and the sparse array can be looked at without locking
+static id_t spawn_stage_next_id(SpawnPhase* phase, SpawnStage* stage) {
+    const World* world = phase->world;
+    if (stage->block_next == stage->block_end) {
+        const id_t block = atomic_fetch_add_explicit(&phase->cursor, SPAWN_ID_BLOCK_SIZE, memory_order_relaxed);
+        //the world's index range is used up, the positions past it belong to no one
+        if(block >= phase->number_of_positions) exit(EXIT_FAILURE);
+        stage->block_next = block;
+        stage->block_end = phase->number_of_positions - block < SPAWN_ID_BLOCK_SIZE ? phase->number_of_positions : block + SPAWN_ID_BLOCK_SIZE;
+    }
+    const id_t index = world_free_index(world, stage->block_next++);
+    return ENTITY_ID(index, world_index_generation(world, index));
+}
+
+static SpawnGroup* spawn_stage_group(const World* world, SpawnStage* stage, const comp_id_t number_of_components, const comp_id_t* components) {
+    ComponentMask mask;
+    component_mask_init(&mask, components, number_of_components);
+    for (uint32_t g = 0; g < stage->number_of_groups; g++) {
+        if (component_mask_equals(&stage->groups[g]->mask, &mask)) {
+            return stage->groups[g];
+        }
+    }
+
+    SpawnGroup* group = malloc(sizeof(SpawnGroup));
+    if(!group) exit(EXIT_FAILURE);
+    group->mask = mask;
+    group->components = malloc(sizeof(comp_id_t) * (number_of_components ? number_of_components : 1));
+    if(!group->components) exit(EXIT_FAILURE);
+    group->number_of_components = 0;
+    comp_id_t table_components[MAX_COMPONENTS];
+    comp_id_t number_of_table_components = 0;
+    for (uint32_t c = 0; c < world->number_of_components; c++) {
+        if (component_mask_has(&mask, c)) {
+            group->components[group->number_of_components++] = c;
+            if (!world_is_sparse_component(world, c)) {
+                table_components[number_of_table_components++] = c;
+            }
+        }
+    }
+    archetype_init(
+        &group->archetype,
+        ARCH_ID_INVALID,
+        world->all_components_data,
+        number_of_table_components,
+        table_components,
+        world->dense_array_chunk_size,
+        world->chunk_byte_budget,
+        0,
+        NULL);
+
+    stage->groups = realloc(stage->groups, sizeof(SpawnGroup*) * (stage->number_of_groups + 1));
+    if(!stage->groups) exit(EXIT_FAILURE);
+    stage->groups[stage->number_of_groups++] = group;
+    return group;
+}
+
+//the block comes from the allocator because the pool is not thread-safe, it joins the pool once published
+static ArchetypeDataChunk* spawn_group_add_chunk(const World* world, Archetype* archetype) {
+    archetype_reserve_chunks(archetype, archetype->number_of_chunks + 1);
+    uint8_t* block = world->chunk_pool.allocator.allocate(archetype->chunk_block_size, CACHE_SIZE, world->chunk_pool.allocator.user_data);
+    if(!block) exit(EXIT_FAILURE);
+    ECS_PROFILE_CHUNK_ALLOCATE(block, archetype->chunk_block_size);
+    ArchetypeDataChunk* chunk = &archetype->chunks[archetype->number_of_chunks++];
+    archetype_data_chunk_init_block(chunk, archetype, block);
+    return chunk;
+}
+
+chunks_length_t spawn_phase_add_entities(
+    SpawnPhase* phase,
+    const uint32_t stage_index,
+    const id_t number_of_entities,
+    const comp_id_t number_of_components,
+    const comp_id_t* components,
+    id_t* out_ids,
+    SpawnRange** out_ranges)
+{
+    SpawnStage* stage = phase->stages[stage_index];
+    Archetype* archetype = &spawn_stage_group(phase->world, stage, number_of_components, components)->archetype;
+    const chunk_size_t chunk_size = archetype->chunk_size;
+
+    SpawnRange* ranges = NULL;
+    if (out_ranges) {
+        ranges = malloc(sizeof(SpawnRange) * ((number_of_entities + chunk_size - 1) / chunk_size + 1));
+        if(!ranges) exit(EXIT_FAILURE);
+        *out_ranges = ranges;
+    }
+
+    chunks_length_t number_of_ranges = 0;
+    id_t spawned = 0;
+    while (spawned < number_of_entities) {
+        ArchetypeDataChunk* chunk = archetype->number_of_chunks ? &archetype->chunks[archetype->number_of_chunks - 1] : NULL;
+        if (!chunk || chunk->dense_arrays_length == chunk_size) {
+            chunk = spawn_group_add_chunk(phase->world, archetype);
+        }
+        const chunk_size_t begin = chunk->dense_arrays_length;
+        const chunk_size_t count = number_of_entities - spawned < chunk_size - begin ? number_of_entities - spawned : chunk_size - begin;
+        for (chunk_size_t r = 0; r < count; r++) {
+            chunk->id_dense_array[begin + r] = spawn_stage_next_id(phase, stage);
+        }
+        if (out_ids) {
+            memcpy(&out_ids[spawned], &chunk->id_dense_array[begin], sizeof(id_t) * count);
+        }
+        chunk->dense_arrays_length += count;
+
+        if (ranges) {
+            ranges[number_of_ranges].archetype = archetype;
+            ranges[number_of_ranges].columns = chunk->columns;
+            ranges[number_of_ranges].begin = begin;
+            ranges[number_of_ranges].end = begin + count;
+        }
+        number_of_ranges++;
+        spawned += count;
+    }
+    return number_of_ranges;
+}
+
+void** spawn_range_component_fields(const SpawnRange* range, const comp_id_t component_id) {
+    const comp_id_t component_index = archetype_component_index(range->archetype, component_id);
+    if (component_index == range->archetype->number_of_components) {
+        return NULL;
+    }
+    return &range->columns[range->archetype->component_columns[component_index]];
+}
+
+//hands the staged chunks to the world's archetype, the rows stay where they are
+static void world_publish_spawn_group(World* world, SpawnGroup* group) {
+    Archetype* staged = &group->archetype;
+    const arch_id_t archetype_id = world_get_or_add_archetype(world, group->number_of_components, group->components);
+    Archetype* archetype = &world->archetypes[archetype_id];
+    assert(archetype->chunk_block_size == staged->chunk_block_size);
+    archetype_reserve_chunks(archetype, archetype->number_of_chunks + staged->number_of_chunks);
+
+    for (chunks_length_t c = 0; c < staged->number_of_chunks; c++) {
+        const chunks_length_t chunk_index = archetype->number_of_chunks++;
+        ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+        *chunk = staged->chunks[c];
+        if (chunk->dense_arrays_length < archetype->chunk_size) {
+            archetype->free_chunks[archetype->number_of_free_chunks++] = chunk_index;
+        }
+        world_on_chunk_added(world, archetype_id, chunk_index);
+        world_touch_chunk(world, archetype, chunk_index);
+
+        for (chunk_size_t row = 0; row < chunk->dense_arrays_length; row++) {
+            const id_t entity_id = chunk->id_dense_array[row];
+            world_reserve_sparse_page(world, world_entity_slot(world, entity_id));
+            world_set_entity_location(world, entity_id, archetype_id, chunk_index, row);
+            world_insert_sparse_rows(world, entity_id, group->number_of_components, group->components);
+        }
+    }
+    //the blocks belong to the world now
+    staged->number_of_chunks = 0;
+}
+
+void world_end_spawn_phase(World* world, SpawnPhase* phase) {
+    assert(phase->world == world);
+    const id_t cursor = atomic_load_explicit(&phase->cursor, memory_order_relaxed);
+    const id_t end = cursor < phase->number_of_positions ? cursor : phase->number_of_positions;
+
+    //the reserved indexes are taken, the ones the stages did not use go back on the stack
+    id_t number_of_unused = 0;
+    for (uint32_t s = 0; s < phase->number_of_stages; s++) {
+        number_of_unused += phase->stages[s]->block_end - phase->stages[s]->block_next;
+    }
+    id_t* unused = malloc(sizeof(id_t) * (number_of_unused ? number_of_unused : 1));
+    if(!unused) exit(EXIT_FAILURE);
+    id_t u = 0;
+    for (uint32_t s = 0; s < phase->number_of_stages; s++) {
+        for (id_t position = phase->stages[s]->block_next; position < phase->stages[s]->block_end; position++) {
+            unused[u++] = world_free_index(world, position);
+        }
+    }
+    const id_t number_of_released = end < world->id_stack_top_index ? end : world->id_stack_top_index;
+    world->id_stack_top_index -= number_of_released;
+    world->next_entity_slot += end - number_of_released;
+    world_reserve_id_stack(world, world->id_stack_top_index + number_of_unused);
+    for (u = 0; u < number_of_unused; u++) {
+        world->id_stack_ids[world->id_stack_top_index++] = unused[u];
+    }
+    free(unused);
+
+    for (uint32_t s = 0; s < phase->number_of_stages; s++) {
+        SpawnStage* stage = phase->stages[s];
+        for (uint32_t g = 0; g < stage->number_of_groups; g++) {
+            SpawnGroup* group = stage->groups[g];
+            world_publish_spawn_group(world, group);
+            archetype_destroy(&group->archetype, &world->chunk_pool);
+            free(group->components);
+            free(group);
+        }
+        free(stage->groups);
+        free(stage);
+    }
+    free(phase->stages);
+    free(phase);
+}
+
+
+//ComponentIterator Functions
+//a structural change or a write to a column of one of the present components after tick
+static bool query_chunk_changed(
+    const Archetype* archetype,
+    const ArchetypeDataChunk* chunk,
+    const comp_id_t* components,
+    const uint32_t* first_columns,
+    const comp_id_t number_of_components,
+    const uint32_t tick)
+{
+    if (chunk->structure_tick > tick) {
+        return true;
+    }
+    for (comp_id_t co = 0; co < number_of_components; co++) {
+        if (first_columns[co] != UINT32_MAX && archetype_chunk_component_changed(archetype, chunk, components[co], tick)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//the change ticks live in the chunk blocks, so stamping the written columns leaves the world itself untouched
+static ComponentIterator world_collect_iterator(const World* world, const QueryDesc* desc) {
+    assert(world_desc_is_table_only(world, desc));
+    ComponentIterator iterator = { .component_field_arrays = NULL, .chunk_lengths = NULL, .number_of_chunks = 0 };
+    chunks_length_t total_chunks = 0;
+
+    QueryFilter filter;
+    query_filter_init(&filter, desc);
+
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        if (query_filter_matches(&filter, &world->archetypes[a].mask)) {
+            total_chunks += world->archetypes[a].number_of_chunks;
+        }
+    }
+
+    if (total_chunks == 0) {
+        return iterator;
+    }
+
+    iterator.component_field_arrays = malloc(sizeof(void***) * total_chunks);
+    if(!iterator.component_field_arrays) exit(EXIT_FAILURE);
+
+    iterator.chunk_lengths = malloc(sizeof(chunk_size_t) * total_chunks);
+    if(!iterator.chunk_lengths) exit(EXIT_FAILURE);
+
+    const comp_id_t number_of_components = query_desc_number_of_columns(desc);
+    comp_id_t* component_ids = malloc(sizeof(comp_id_t) * number_of_components);
+    if(!component_ids && number_of_components) exit(EXIT_FAILURE);
+    query_desc_columns(desc, component_ids);
 
-    component_data_init(
-        &world->all_components_data[world->number_of_components],
-        field_sizes,
-        number_of_fields);
+    //first column of every requested component, resolved once per archetype, absent ones get UINT32_MAX
+    uint32_t* first_columns = malloc(sizeof(uint32_t) * number_of_components);
+    if(!first_columns && number_of_components) exit(EXIT_FAILURE);
 
-    return world->number_of_components++;
-}
+    chunks_length_t current_chunk_index = 0;
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        Archetype* archetype = &world->archetypes[a];
 
-id_t world_add_entity(World* world, const comp_id_t number_of_components, const comp_id_t* components) {
-    //pop an id from the stack
-    if (world->id_stack_top_index >= world->id_stack_capacity) {
-        world->id_stack_capacity *= 2;
-        world->id_stack_ids = realloc(world->id_stack_ids, sizeof(id_t) * world->id_stack_capacity);
-        if(!world->id_stack_ids) exit(EXIT_FAILURE);
-        // Initialize new part of the stack
-        for(id_t i = world->id_stack_top_index; i < world->id_stack_capacity; ++i) {
-            world->id_stack_ids[i] = i;
+        if (query_filter_matches(&filter, &archetype->mask)) {
+            for (comp_id_t co = 0; co < number_of_components; co++) {
+                first_columns[co] = component_mask_has(&archetype->mask, component_ids[co])
+                    ? archetype->component_columns[archetype_component_index(archetype, component_ids[co])]
+                    : UINT32_MAX;
+            }
+            for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
+                ArchetypeDataChunk* chunk = &archetype->chunks[ch];
+                if (desc->changed_since != 0 &&
+                    !query_chunk_changed(archetype, chunk, component_ids, first_columns, number_of_components, desc->changed_since)) {
+                    continue;
+                }
+                if (desc->cull_by_key && world_chunk_outside_key_range(world, archetype, chunk, desc->sort_key, desc->key_min, desc->key_max)) {
+                    continue;
+                }
+                //stamped after the check so a system does not see its own writes as changes this tick
+                for (comp_id_t w = 0; w < desc->number_of_written; w++) {
+                    if (component_mask_has(&archetype->mask, desc->written[w])) {
+                        archetype_chunk_mark_component(archetype, chunk, desc->written[w], world->change_tick);
+                    }
+                }
+
+                iterator.component_field_arrays[current_chunk_index] = malloc(sizeof(void**) * number_of_components);
+                if(!iterator.component_field_arrays[current_chunk_index] && number_of_components) exit(EXIT_FAILURE);
+
+                for (comp_id_t co = 0; co < number_of_components; co++) {
+                    iterator.component_field_arrays[current_chunk_index][co] =
+                        first_columns[co] == UINT32_MAX ? NULL : &chunk->columns[first_columns[co]];
+                }
+                iterator.chunk_lengths[current_chunk_index] = chunk->dense_arrays_length;
+                current_chunk_index++;
+            }
         }
     }
-    const id_t id = world->id_stack_ids[world->id_stack_top_index++];
+    //unchanged chunks were left out
+    iterator.number_of_chunks = current_chunk_index;
+    free(first_columns);
+    free(component_ids);
+    return iterator;
+}
+
+ComponentIterator world_get_filtered_iterator(World* world, const QueryDesc* desc) {
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_get_filtered_iterator");
+    const ComponentIterator iterator = world_collect_iterator(world, desc);
+    ECS_PROFILE_ZONE_END(zone);
+    return iterator;
+}
+
+ComponentIterator world_get_component_iterator(const World* world, const comp_id_t* component_ids, const comp_id_t number_of_components) {
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_get_component_iterator");
+    const QueryDesc desc = { .required = component_ids, .number_of_required = number_of_components };
+    const ComponentIterator iterator = world_collect_iterator(world, &desc);
+    ECS_PROFILE_ZONE_END(zone);
+    return iterator;
+}
 
-    //sort components so that order does not matter
-    comp_id_t* sorted_components = alloca(sizeof(comp_id_t) * number_of_components);
-    if(!sorted_components) exit(EXIT_FAILURE);
-    for(comp_id_t i = 0; i < number_of_components; ++i) {
-        sorted_components[i] = components[i];
+void component_iterator_destroy(ComponentIterator* iterator) {
+    if (iterator->component_field_arrays) {
+        for (chunks_length_t i = 0; i < iterator->number_of_chunks; i++) {
+            free(iterator->component_field_arrays[i]); // Free the inner array
+        }
+        free(iterator->component_field_arrays); // Free the outer array
+        iterator->component_field_arrays = NULL;
+    }
+    if (iterator->chunk_lengths) {
+        free(iterator->chunk_lengths);
+        iterator->chunk_lengths = NULL;
     }
-    qsort(sorted_components, number_of_components, sizeof(comp_id_t), compare_comp_ids);
+    iterator->number_of_chunks = 0;
+}
 
 
-    chunks_length_t chunk_index = 0;
-    id_t id_dense_array_index = 0;
-    arch_id_t matched_arch_id = 0;
+//QueryIter Functions
+void query_iter_begin(QueryIter* iter, const World* world, const QueryDesc* desc) {
+    assert(query_desc_number_of_columns(desc) <= QUERY_ITER_MAX_COLUMNS);
+    assert(world_desc_is_table_only(world, desc));
+    iter->world = world;
+    query_filter_init(&iter->filter, desc);
+    iter->number_of_components = query_desc_columns(desc, iter->components);
+    iter->changed_since = desc->changed_since;
+    iter->cull_by_key = desc->cull_by_key;
+    iter->sort_key = desc->sort_key;
+    iter->key_min = desc->key_min;
+    iter->key_max = desc->key_max;
+    iter->next_archetype = 0;
+    iter->next_chunk = 0;
+    iter->length = 0;
+    iter->archetype_id = ARCH_ID_INVALID;
+    iter->chunk_index = 0;
+}
 
-    //try to fit to already existing archetype
-    if (world_match_archetype(world, number_of_components, sorted_components, &matched_arch_id)) {
-        archetype_add_entity(
-            &world->archetypes[matched_arch_id],
-            id,
-            world->number_of_components,
-            world->all_components_data,
-            &id_dense_array_index,
-            &chunk_index);
-    }
-    //if no such archetype exists create a new archetype
-    else {
-        matched_arch_id = world_add_archetype(world, number_of_components, sorted_components);
-        archetype_add_entity(
-            &world->archetypes[matched_arch_id],
-            id,
-            world->number_of_components,
-            world->all_components_data,
-            &id_dense_array_index,
-            &chunk_index);
-    }
-
-    const chunks_length_t sparse_chunk_index = id / world->sparse_array_chunk_size;
-
-    if (sparse_chunk_index >= world->sparse_array_number_of_chunks) {
-        chunks_length_t new_chunk_count = world->sparse_array_number_of_chunks + 1;
-        world->sparse_array_chunks = realloc(
-            world->sparse_array_chunks,
-            sizeof(SparseArrayChunk) * new_chunk_count
-        );
-        if(!world->sparse_array_chunks) exit(EXIT_FAILURE);
+//resolves the columns of the archetype once, when its first chunk is reached
+static void query_iter_enter_archetype(QueryIter* iter, const Archetype* archetype) {
+    for (comp_id_t co = 0; co < iter->number_of_components; co++) {
+        iter->first_columns[co] = component_mask_has(&archetype->mask, iter->components[co])
+            ? archetype->component_columns[archetype_component_index(archetype, iter->components[co])]
+            : UINT32_MAX;
+    }
+}
+
+bool query_iter_next_chunk(QueryIter* iter) {
+    const World* world = iter->world;
+    while (iter->next_archetype < world->number_of_archetypes) {
+        const Archetype* archetype = &world->archetypes[iter->next_archetype];
+        if (iter->next_chunk == 0) {
+            if (!query_filter_matches(&iter->filter, &archetype->mask)) {
+                iter->next_archetype++;
+                continue;
+            }
+            query_iter_enter_archetype(iter, archetype);
+        }
+        if (iter->next_chunk >= archetype->number_of_chunks) {
+            iter->next_archetype++;
+            iter->next_chunk = 0;
+            continue;
+        }
 
-        for(chunks_length_t i = world->sparse_array_number_of_chunks; i < new_chunk_count; ++i) {
-            sparse_array_chunk_init(
-                &world->sparse_array_chunks[i],
-                world->sparse_array_chunk_size);
+        const chunks_length_t chunk_index = iter->next_chunk++;
+        const ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+        if (chunk->dense_arrays_length == 0 ||
+            (iter->changed_since != 0 && !query_chunk_changed(archetype, chunk, iter->components, iter->first_columns,
+                                                              iter->number_of_components, iter->changed_since)) ||
+            (iter->cull_by_key && world_chunk_outside_key_range(world, archetype, chunk, iter->sort_key, iter->key_min, iter->key_max))) {
+            continue;
         }
-        world->sparse_array_number_of_chunks = new_chunk_count;
+        for (comp_id_t co = 0; co < iter->number_of_components; co++) {
+            iter->columns[co] = iter->first_columns[co] == UINT32_MAX ? NULL : &chunk->columns[iter->first_columns[co]];
+        }
+        iter->length = chunk->dense_arrays_length;
+        iter->archetype_id = archetype->archetype_id;
+        iter->chunk_index = chunk_index;
+        return true;
     }
+    iter->length = 0;
+    return false;
+}
 
-    const id_t local_id_index = id % world->sparse_array_chunk_size;
+//Query Iteration Functions
+query_id_t world_add_filtered_query(World* world, const QueryDesc* desc) {
+    world->queries = realloc(world->queries, sizeof(Query) * (world->number_of_queries + 1));
+    if(!world->queries) exit(EXIT_FAILURE);
 
-    world->sparse_array_chunks[sparse_chunk_index].archetypes[local_id_index] = matched_arch_id;
-    world->sparse_array_chunks[sparse_chunk_index].chunk_indexes[local_id_index] = chunk_index;
-    world->sparse_array_chunks[sparse_chunk_index].dense_id_array_indexes[local_id_index] = id_dense_array_index;
-    return id;
+    assert(world_desc_is_table_only(world, desc));
+    Query* query = &world->queries[world->number_of_queries];
+    query_init(query, desc);
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        if (query_filter_matches(&query->filter, &world->archetypes[a].mask)) {
+            query_add_archetype(query, &world->archetypes[a]);
+        }
+    }
+    return world->number_of_queries++;
 }
 
-static bool does_archetype_have_components(const Archetype* archetype, const comp_id_t* comp_ids, const comp_id_t number_of_comps) {
-    if (archetype->number_of_components < number_of_comps) {
-        return false;
-    }
-    for (comp_id_t c = 0; c < number_of_comps; ++c) {
-        bool found_match = false;
-        for (comp_id_t ac = 0; ac < archetype->number_of_components; ++ac) {
-            if (archetype->components[ac] == comp_ids[c]) {
-                found_match = true;
-                break;
+query_id_t world_add_query(World* world, const comp_id_t* component_ids, const comp_id_t number_of_components) {
+    const QueryDesc desc = { .required = component_ids, .number_of_required = number_of_components };
+    return world_add_filtered_query(world, &desc);
+}
+
+const ComponentIterator* world_get_query_iterator(World* world, const query_id_t query_id) {
+    ECS_PROFILE_ZONE_BEGIN(zone, "world_get_query_iterator");
+    Query* query = &world->queries[query_id];
+    uint64_t rows = 0;
+    for (chunks_length_t c = 0; c < query->iterator.number_of_chunks; c++) {
+        const Archetype* archetype = &world->archetypes[query->chunk_archetypes[c]];
+        ArchetypeDataChunk* chunk = &archetype->chunks[query->chunk_indexes[c]];
+        query->iterator.chunk_lengths[c] = chunk->dense_arrays_length;
+        rows += chunk->dense_arrays_length;
+        for (comp_id_t w = 0; w < query->number_of_written; w++) {
+            if (component_mask_has(&archetype->mask, query->written[w])) {
+                archetype_chunk_mark_component(archetype, chunk, query->written[w], world->change_tick);
             }
         }
-        if (!found_match) {
-            return false;
-        }
     }
-    return true;
+    query->number_of_iterations++;
+    query->rows_iterated += rows;
+    ECS_PROFILE_ZONE_END(zone);
+    return &query->iterator;
 }
 
-void world_remove_entity(World* world, const id_t entity_id) {
 
-    //return the deleted ID to the stack
-    world->id_stack_ids[--world->id_stack_top_index] = entity_id;
+//Change Tick Functions
+uint32_t world_get_tick(const World* world) {
+    return world->change_tick;
+}
 
-    //find the location of the entity to be removed
-    const chunks_length_t sparse_array_chunk_index = entity_id / world->sparse_array_chunk_size;
-    assert(sparse_array_chunk_index < world->sparse_array_number_of_chunks);
+uint32_t world_advance_tick(World* world) {
+    return ++world->change_tick;
+}
 
-    const SparseArrayChunk* sparse_array_chunk = &world->sparse_array_chunks[sparse_array_chunk_index];
-    const id_t local_id_index = entity_id % world->sparse_array_chunk_size;
+void world_mark_chunk_changed(World* world, const arch_id_t archetype_id, const chunks_length_t chunk_index, const comp_id_t component_id) {
+    const Archetype* archetype = &world->archetypes[archetype_id];
+    if (component_mask_has(&archetype->mask, component_id)) {
+        archetype_chunk_mark_component(archetype, &archetype->chunks[chunk_index], component_id, world->change_tick);
+    }
+}
 
-    const arch_id_t archetype_id = sparse_array_chunk->archetypes[local_id_index];
-    const chunks_length_t chunk_index = sparse_array_chunk->chunk_indexes[local_id_index];
-    const id_t dense_id_array_index = sparse_array_chunk->dense_id_array_indexes[local_id_index];
+bool world_chunk_changed_since(
+    const World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const comp_id_t component_id,
+    const uint32_t tick)
+{
+    const Archetype* archetype = &world->archetypes[archetype_id];
+    const ArchetypeDataChunk* chunk = &archetype->chunks[chunk_index];
+    if (!component_mask_has(&archetype->mask, component_id)) {
+        return chunk->structure_tick > tick;
+    }
+    return archetype_chunk_component_changed(archetype, chunk, component_id, tick);
+}
 
-    Archetype* archetype = &world->archetypes[archetype_id];
-    ArchetypeDataChunk* archetype_data_chunk = &archetype->chunks[chunk_index];
 
-    const id_t dense_id_array_length = archetype_data_chunk->dense_arrays_length;
-    const id_t last_element_index = dense_id_array_length - 1;
+//Stats Functions
+static size_t archetype_row_bytes(const Archetype* archetype) {
+    size_t bytes = sizeof(id_t);
+    for (uint32_t c = 0; c < archetype->number_of_columns; c++) {
+        bytes += archetype->column_sizes[c];
+    }
+    return bytes;
+}
 
-    // If the entity to be removed is the last one in the array,
-    // we can simply decrement the length. No swapping is needed.
-    if (dense_id_array_index == last_element_index) {
-        archetype_data_chunk->dense_arrays_length--;
-        return;
+static size_t component_set_bytes(const ComponentData* component) {
+    const ComponentSet* set = &component->set;
+    size_t row_bytes = sizeof(id_t);
+    for (comp_size_t f = 0; f < component->number_of_fields; f++) {
+        row_bytes += component->field_sizes[f];
     }
+    return (size_t)set->positions_capacity * sizeof(id_t) + (size_t)set->capacity * row_bytes;
+}
 
-    //get the ID of the entity at the last position.
-    const id_t last_entity_id = archetype_data_chunk->id_dense_array[last_element_index];
+WorldStats world_get_stats(const World* world) {
+    WorldStats stats;
+    memset(&stats, 0, sizeof(WorldStats));
+    stats.number_of_archetypes = world->number_of_archetypes;
+    stats.number_of_queries = world->number_of_queries;
+    stats.archetypes = malloc(sizeof(ArchetypeStats) * (world->number_of_archetypes ? world->number_of_archetypes : 1));
+    if(!stats.archetypes) exit(EXIT_FAILURE);
+    stats.queries = malloc(sizeof(QueryStats) * (world->number_of_queries ? world->number_of_queries : 1));
+    if(!stats.queries) exit(EXIT_FAILURE);
 
-    //move the last entity's ID into the deleted entity's slot.
-    archetype_data_chunk->id_dense_array[dense_id_array_index] = last_entity_id;
+    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
+        const Archetype* archetype = &world->archetypes[a];
+        ArchetypeStats* archetype_stats = &stats.archetypes[a];
+        id_t number_of_entities = 0;
+        for (chunks_length_t c = 0; c < archetype->number_of_chunks; c++) {
+            number_of_entities += archetype->chunks[c].dense_arrays_length;
+        }
+        const size_t rows = (size_t)archetype->number_of_chunks * archetype->chunk_size;
+        archetype_stats->number_of_entities = number_of_entities;
+        archetype_stats->number_of_chunks = archetype->number_of_chunks;
+        archetype_stats->chunk_size = archetype->chunk_size;
+        archetype_stats->number_of_components = archetype->number_of_components;
+        archetype_stats->fill_ratio = rows ? (double)number_of_entities / (double)rows : 0.0;
+        archetype_stats->bytes_allocated = (size_t)archetype->number_of_chunks * archetype->chunk_block_size;
+        archetype_stats->bytes_used = (size_t)number_of_entities * archetype_row_bytes(archetype);
 
-    //move the last entity's component data into the deleted entity's slot.
-    for (comp_id_t c=0; c<archetype->number_of_components; c++) {
-        const comp_id_t component_index = archetype->components[c];
-        const ComponentData* component_data = &world->all_components_data[component_index];
-        for (comp_size_t f=0; f<component_data->number_of_fields; f++) {
-            comp_size_t field_size = component_data->field_sizes[f];
-            void* dest = archetype_data_chunk->component_field_arrays[component_index][f] + (dense_id_array_index * field_size);
-            const void* src = archetype_data_chunk->component_field_arrays[component_index][f] + (last_element_index * field_size);
-            memcpy(dest, src, field_size);
+        stats.number_of_entities += number_of_entities;
+        stats.chunk_bytes_allocated += archetype_stats->bytes_allocated;
+        stats.chunk_bytes_used += archetype_stats->bytes_used;
+    }
+
+    for (query_id_t q = 0; q < world->number_of_queries; q++) {
+        const Query* query = &world->queries[q];
+        stats.queries[q].number_of_iterations = query->number_of_iterations;
+        stats.queries[q].rows_iterated = query->rows_iterated;
+        stats.queries[q].number_of_archetypes = query->number_of_archetypes;
+        stats.queries[q].number_of_chunks = query->iterator.number_of_chunks;
+    }
+
+    for (uint32_t b = 0; b < world->chunk_pool.number_of_buckets; b++) {
+        stats.chunk_pool_bytes += (size_t)world->chunk_pool.buckets[b].number_of_blocks * world->chunk_pool.buckets[b].block_size;
+    }
+
+    stats.sparse_array_bytes = (size_t)world->sparse_array_chunks_capacity * sizeof(SparseArrayChunk);
+    for (chunks_length_t c = 0; c < world->sparse_array_number_of_chunks; c++) {
+        if (world->sparse_array_chunks[c].entries) {
+            stats.sparse_array_bytes += (size_t)world->sparse_array_chunk_size * sizeof(SparseEntry);
         }
     }
+    for (comp_id_t s = 0; s < world->number_of_sparse_components; s++) {
+        stats.sparse_component_bytes += component_set_bytes(&world->all_components_data[world->sparse_components[s]]);
+    }
 
+    stats.id_stack_size = world->id_stack_top_index;
+    stats.id_stack_bytes = (size_t)world->id_stack_capacity * sizeof(id_t);
+    return stats;
+}
+
+void world_stats_destroy(WorldStats* stats) {
+    free(stats->archetypes);
+    free(stats->queries);
+    stats->archetypes = NULL;
+    stats->queries = NULL;
+}
 
-    //update the sparse array for the moved entity
-    const chunks_length_t sparse_chunk_for_moved_entity = last_entity_id / world->sparse_array_chunk_size;
-    const id_t local_id_for_moved_entity = last_entity_id % world->sparse_array_chunk_size;
-    world->sparse_array_chunks[sparse_chunk_for_moved_entity].dense_id_array_indexes[local_id_for_moved_entity] = dense_id_array_index;
 
-    archetype_data_chunk->dense_arrays_length--;
+//Parallel Query Functions
+#define PARALLEL_QUERY_MIN_ROWS_PER_JOB 1024
+#define PARALLEL_QUERY_JOBS_PER_THREAD 4
+
+typedef struct ChunkJob {
+    chunks_length_t chunk_index;
+    chunk_size_t begin;
+    chunk_size_t end;
+} ChunkJob;
+
+typedef struct ParallelQuery {
+    const ComponentIterator* iterator;
+    const ChunkJob* jobs;
+    ChunkCallback callback;
+    void* user_data;
+} ParallelQuery;
+
+static void parallel_query_run_job(const uint32_t job_index, void* user_data) {
+    const ParallelQuery* query = user_data;
+    const ChunkJob* job = &query->jobs[job_index];
+    query->callback(query->iterator->component_field_arrays[job->chunk_index], job->begin, job->end, query->user_data);
 }
 
-void* world_get_component_field(
-    const World* world,
-    const id_t entity_id,
-    const comp_id_t component_id,
-    const comp_size_t field_index
-)
+static void run_parallel_query(
+    const ComponentIterator* iterator,
+    JobSystem* job_system,
+    const ChunkCallback callback,
+    void* user_data,
+    chunk_size_t rows_per_job)
 {
-    //find the entity's location using the sparse array
-    const chunks_length_t sparse_chunk_index = entity_id / world->sparse_array_chunk_size;
-    if (sparse_chunk_index >= world->sparse_array_number_of_chunks) {
-        return NULL; // Entity ID is out of bounds
+    size_t total_rows = 0;
+    for (chunks_length_t c = 0; c < iterator->number_of_chunks; c++) {
+        total_rows += iterator->chunk_lengths[c];
+    }
+    if (total_rows == 0) {
+        return;
     }
 
-    const SparseArrayChunk* sparse_array_chunk = &world->sparse_array_chunks[sparse_chunk_index];
-    const id_t local_id_index = entity_id % world->sparse_array_chunk_size;
+    //chunks bigger than rows_per_job are split so a single huge chunk still spreads over all threads
+    if (rows_per_job == 0) {
+        const size_t target_jobs = (size_t)job_system_number_of_threads(job_system) * PARALLEL_QUERY_JOBS_PER_THREAD;
+        const size_t rows = (total_rows + target_jobs - 1) / target_jobs;
+        rows_per_job = rows < PARALLEL_QUERY_MIN_ROWS_PER_JOB ? PARALLEL_QUERY_MIN_ROWS_PER_JOB : (chunk_size_t)rows;
+    }
 
-    const arch_id_t archetype_id = sparse_array_chunk->archetypes[local_id_index];
-    const chunks_length_t chunk_index = sparse_array_chunk->chunk_indexes[local_id_index];
-    const id_t dense_id_array_index = sparse_array_chunk->dense_id_array_indexes[local_id_index];
+    uint32_t number_of_jobs = 0;
+    for (chunks_length_t c = 0; c < iterator->number_of_chunks; c++) {
+        number_of_jobs += (iterator->chunk_lengths[c] + rows_per_job - 1) / rows_per_job;
+    }
 
-    const Archetype* archetype = &world->archetypes[archetype_id];
+    ChunkJob* jobs = malloc(sizeof(ChunkJob) * number_of_jobs);
+    if(!jobs) exit(EXIT_FAILURE);
 
-    //validate that the entity actually has this component
-    bool has_component = false;
-    for (comp_id_t i = 0; i < archetype->number_of_components; ++i) {
-        if (archetype->components[i] == component_id) {
-            has_component = true;
-            break;
+    uint32_t job_index = 0;
+    for (chunks_length_t c = 0; c < iterator->number_of_chunks; c++) {
+        for (chunk_size_t begin = 0; begin < iterator->chunk_lengths[c]; begin += rows_per_job) {
+            const chunk_size_t remaining = iterator->chunk_lengths[c] - begin;
+            jobs[job_index].chunk_index = c;
+            jobs[job_index].begin = begin;
+            jobs[job_index].end = begin + (remaining < rows_per_job ? remaining : rows_per_job);
+            job_index++;
         }
     }
-    if (!has_component) {
-        return NULL; //this entity does not have the requested component
+
+    ParallelQuery query = { .iterator = iterator, .jobs = jobs, .callback = callback, .user_data = user_data };
+    job_system_parallel_for(job_system, number_of_jobs, parallel_query_run_job, &query);
+
+    free(jobs);
+}
+
+void world_query_for_each_parallel(
+    const World* world,
+    JobSystem* job_system,
+    const comp_id_t* component_ids,
+    const comp_id_t number_of_components,
+    const ChunkCallback callback,
+    void* user_data,
+    const chunk_size_t rows_per_job)
+{
+    ComponentIterator iterator = world_get_component_iterator(world, component_ids, number_of_components);
+    run_parallel_query(&iterator, job_system, callback, user_data, rows_per_job);
+    component_iterator_destroy(&iterator);
+}
+
+void world_query_for_each_parallel_cached(
+    World* world,
+    JobSystem* job_system,
+    const query_id_t query_id,
+    const ChunkCallback callback,
+    void* user_data,
+    const chunk_size_t rows_per_job)
+{
+    run_parallel_query(world_get_query_iterator(world, query_id), job_system, callback, user_data, rows_per_job);
+}
+
+
+//CommandBuffer Functions
+CommandBuffer command_buffer_create(void) {
+    CommandBuffer this = {
+        .commands = NULL,
+        .number_of_commands = 0,
+        .commands_capacity = 0,
+        .component_storage = NULL,
+        .component_storage_length = 0,
+        .component_storage_capacity = 0,
+        .created_ids = NULL,
+        .number_of_creates = 0,
+        .created_ids_capacity = 0
+    };
+    return this;
+}
+
+void command_buffer_destroy(CommandBuffer* buffer) {
+    free(buffer->commands);
+    free(buffer->component_storage);
+    free(buffer->created_ids);
+    buffer->commands = NULL;
+    buffer->component_storage = NULL;
+    buffer->created_ids = NULL;
+}
+
+static Command* command_buffer_push(CommandBuffer* buffer, const CommandType type, const id_t entity_id, const comp_id_t component) {
+    //created ids of the previous flush are dropped once recording starts again
+    if (buffer->number_of_commands == 0) {
+        buffer->number_of_creates = 0;
+    }
+    if (buffer->number_of_commands == buffer->commands_capacity) {
+        buffer->commands_capacity = buffer->commands_capacity ? buffer->commands_capacity * 2 : 64;
+        buffer->commands = realloc(buffer->commands, sizeof(Command) * buffer->commands_capacity);
+        if(!buffer->commands) exit(EXIT_FAILURE);
     }
+    Command* command = &buffer->commands[buffer->number_of_commands];
+    command->entity_id = entity_id;
+    command->order = buffer->number_of_commands++;
+    command->components_offset = 0;
+    command->component = component;
+    command->archetype_id = ARCH_ID_INVALID;
+    command->type = type;
+    return command;
+}
 
-    //validate the field index
-    const ComponentData* component_data = &world->all_components_data[component_id];
-    if (field_index >= component_data->number_of_fields) {
-        return NULL; // The component does not have this many fields
+uint32_t command_buffer_create_entity(CommandBuffer* buffer, const comp_id_t number_of_components, const comp_id_t* components) {
+    if (buffer->component_storage_length + number_of_components > buffer->component_storage_capacity) {
+        uint32_t capacity = buffer->component_storage_capacity ? buffer->component_storage_capacity : 64;
+        while (buffer->component_storage_length + number_of_components > capacity) {
+            capacity *= 2;
+        }
+        buffer->component_storage = realloc(buffer->component_storage, sizeof(comp_id_t) * capacity);
+        if(!buffer->component_storage) exit(EXIT_FAILURE);
+        buffer->component_storage_capacity = capacity;
     }
 
-    //calculate the pointer to the specific field data
-    const ArchetypeDataChunk* archetype_data_chunk = &archetype->chunks[chunk_index];
-    const comp_size_t field_size = component_data->field_sizes[field_index];
+    Command* command = command_buffer_push(buffer, COMMAND_CREATE_ENTITY, 0, number_of_components);
+    const uint32_t create_index = buffer->number_of_creates++;
+    command->entity_id = create_index;
+    command->components_offset = buffer->component_storage_length;
+    memcpy(&buffer->component_storage[buffer->component_storage_length], components, sizeof(comp_id_t) * number_of_components);
+    buffer->component_storage_length += number_of_components;
+    return create_index;
+}
 
-    //get the base address of the dense array for this specific component field
-    uint8_t* field_array_base = archetype_data_chunk->component_field_arrays[component_id][field_index];
+void command_buffer_destroy_entity(CommandBuffer* buffer, const id_t entity_id) {
+    command_buffer_push(buffer, COMMAND_DESTROY_ENTITY, entity_id, 0);
+}
 
-    //calculate the offset to the entity's data within that array
-    return field_array_base + (dense_id_array_index * field_size);
+void command_buffer_add_component(CommandBuffer* buffer, const id_t entity_id, const comp_id_t component_id) {
+    command_buffer_push(buffer, COMMAND_ADD_COMPONENT, entity_id, component_id);
 }
 
-//ComponentIterator Functions
-ComponentIterator world_get_component_iterator(const World* world, const comp_id_t* component_ids, const comp_id_t number_of_components) {
-    ComponentIterator iterator = { .component_field_arrays = NULL, .chunk_lengths = NULL, .number_of_chunks = 0 };
-    chunks_length_t total_chunks = 0;
+void command_buffer_remove_component(CommandBuffer* buffer, const id_t entity_id, const comp_id_t component_id) {
+    command_buffer_push(buffer, COMMAND_REMOVE_COMPONENT, entity_id, component_id);
+}
 
-    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
-        if (does_archetype_have_components(&world->archetypes[a], component_ids, number_of_components)) {
-            total_chunks += world->archetypes[a].number_of_chunks;
+//creates last, everything else grouped per entity in recording order
+static int compare_commands_by_entity(const void* a, const void* b) {
+    const Command* command_a = a;
+    const Command* command_b = b;
+    const bool create_a = command_a->type == COMMAND_CREATE_ENTITY;
+    const bool create_b = command_b->type == COMMAND_CREATE_ENTITY;
+    if (create_a != create_b) return create_a ? 1 : -1;
+    if (!create_a && command_a->entity_id != command_b->entity_id) return command_a->entity_id < command_b->entity_id ? -1 : 1;
+    if (command_a->order != command_b->order) return command_a->order < command_b->order ? -1 : 1;
+    return 0;
+}
+
+static int compare_commands_by_archetype(const void* a, const void* b) {
+    const Command* command_a = a;
+    const Command* command_b = b;
+    if (command_a->archetype_id != command_b->archetype_id) return command_a->archetype_id < command_b->archetype_id ? -1 : 1;
+    if (command_a->order != command_b->order) return command_a->order < command_b->order ? -1 : 1;
+    return 0;
+}
+
+void world_flush_commands(World* world, CommandBuffer* buffer) {
+    const uint32_t number_of_commands = buffer->number_of_commands;
+    Command* commands = buffer->commands;
+    qsort(commands, number_of_commands, sizeof(Command), compare_commands_by_entity);
+
+    id_t* destroyed_ids = malloc(sizeof(id_t) * (number_of_commands ? number_of_commands : 1));
+    if(!destroyed_ids) exit(EXIT_FAILURE);
+    id_t number_of_destroyed = 0;
+
+    //every entity moves at most once, straight to the archetype its last command leaves it in
+    uint32_t i = 0;
+    while (i < number_of_commands && commands[i].type != COMMAND_CREATE_ENTITY) {
+        const id_t entity_id = commands[i].entity_id;
+        uint32_t end = i;
+        bool destroy = false;
+        while (end < number_of_commands && commands[end].type != COMMAND_CREATE_ENTITY && commands[end].entity_id == entity_id) {
+            destroy |= commands[end].type == COMMAND_DESTROY_ENTITY;
+            end++;
         }
+
+        if (!world_is_alive(world, entity_id)) {
+            //stale handle, nothing to apply
+        } else if (destroy) {
+            destroyed_ids[number_of_destroyed++] = entity_id;
+        } else {
+            arch_id_t archetype_id;
+            chunks_length_t chunk_index;
+            id_t dense_id_array_index;
+            world_locate_entity(world, entity_id, &archetype_id, &chunk_index, &dense_id_array_index);
+
+            //sparse components change in place, in recording order
+            arch_id_t target = archetype_id;
+            for (uint32_t c = i; c < end; c++) {
+                const bool add = commands[c].type == COMMAND_ADD_COMPONENT;
+                if (!world_is_sparse_component(world, commands[c].component)) {
+                    target = world_archetype_transition(world, target, commands[c].component, add);
+                } else if (add) {
+                    world_insert_sparse_row(world, entity_id, commands[c].component);
+                } else {
+                    world_remove_sparse_row(world, entity_id, commands[c].component);
+                }
+            }
+            world_move_entity(world, entity_id, target);
+        }
+        i = end;
     }
 
-    if (total_chunks == 0) {
-        return iterator;
+    world_remove_entities(world, destroyed_ids, number_of_destroyed);
+    free(destroyed_ids);
+
+    //resolve the archetype of every create, consecutive creates usually share their component list
+    const uint32_t first_create = i;
+    for (uint32_t c = first_create; c < number_of_commands; c++) {
+        Command* command = &commands[c];
+        const comp_id_t* components = &buffer->component_storage[command->components_offset];
+        if (c > first_create && commands[c - 1].component == command->component &&
+            memcmp(&buffer->component_storage[commands[c - 1].components_offset], components, sizeof(comp_id_t) * command->component) == 0) {
+            command->archetype_id = commands[c - 1].archetype_id;
+        } else {
+            command->archetype_id = world_get_or_add_archetype(world, command->component, components);
+        }
     }
+    qsort(&commands[first_create], number_of_commands - first_create, sizeof(Command), compare_commands_by_archetype);
 
-    iterator.component_field_arrays = malloc(sizeof(void***) * total_chunks);
-    if(!iterator.component_field_arrays) exit(EXIT_FAILURE);
+    if (buffer->number_of_creates > buffer->created_ids_capacity) {
+        buffer->created_ids_capacity = buffer->number_of_creates;
+        buffer->created_ids = realloc(buffer->created_ids, sizeof(id_t) * buffer->created_ids_capacity);
+        if(!buffer->created_ids) exit(EXIT_FAILURE);
+    }
+    id_t* spawned_ids = malloc(sizeof(id_t) * (number_of_commands - first_create + 1));
+    if(!spawned_ids) exit(EXIT_FAILURE);
+    for (uint32_t c = first_create; c < number_of_commands;) {
+        uint32_t end = c + 1;
+        while (end < number_of_commands && commands[end].archetype_id == commands[c].archetype_id) {
+            end++;
+        }
+        world_add_entities_to_archetype(world, commands[c].archetype_id, end - c, spawned_ids, NULL);
+        for (uint32_t k = c; k < end; k++) {
+            buffer->created_ids[commands[k].entity_id] = spawned_ids[k - c];
+            world_insert_sparse_rows(world, spawned_ids[k - c], commands[k].component, &buffer->component_storage[commands[k].components_offset]);
+        }
+        c = end;
+    }
+    free(spawned_ids);
 
-    iterator.chunk_lengths = malloc(sizeof(chunk_size_t) * total_chunks);
-    if(!iterator.chunk_lengths) exit(EXIT_FAILURE);
+    buffer->number_of_commands = 0;
+    buffer->component_storage_length = 0;
+}
 
-    iterator.number_of_chunks = total_chunks;
 
-    chunks_length_t current_chunk_index = 0;
-    for (arch_id_t a = 0; a < world->number_of_archetypes; a++) {
-        Archetype* archetype = &world->archetypes[a];
+//Scheduler Functions
+typedef struct SchedulerWave {
+    const Scheduler* scheduler;
+    const uint32_t* systems;
+    World* world;
+} SchedulerWave;
 
-        if (does_archetype_have_components(archetype, component_ids, number_of_components)) {
-            for (chunks_length_t ch = 0; ch < archetype->number_of_chunks; ch++) {
-                iterator.component_field_arrays[current_chunk_index] = malloc(sizeof(void**) * number_of_components);
-                if(!iterator.component_field_arrays[current_chunk_index]) exit(EXIT_FAILURE);
+Scheduler scheduler_create(void) {
+    Scheduler this = {
+        .systems = NULL,
+        .number_of_systems = 0,
+        .systems_capacity = 0,
+        .waves = NULL,
+        .wave_begins = NULL,
+        .number_of_waves = 0,
+        .waves_outdated = false
+    };
+    return this;
+}
 
-                for (comp_id_t co = 0; co < number_of_components; co++) {
-                    iterator.component_field_arrays[current_chunk_index][co] =
-                        archetype->chunks[ch].component_field_arrays[component_ids[co]];
-                }
-                iterator.chunk_lengths[current_chunk_index] = archetype->chunks[ch].dense_arrays_length;
-                current_chunk_index++;
+void scheduler_destroy(Scheduler* scheduler) {
+    for (uint32_t i = 0; i < scheduler->number_of_systems; i++) {
+        free(scheduler->systems[i].queries);
+    }
+    free(scheduler->systems);
+    free(scheduler->waves);
+    free(scheduler->wave_begins);
+    scheduler->systems = NULL;
+    scheduler->waves = NULL;
+    scheduler->wave_begins = NULL;
+}
+
+uint32_t scheduler_add_system(Scheduler* scheduler, const SystemDesc* desc) {
+    if (scheduler->number_of_systems == scheduler->systems_capacity) {
+        scheduler->systems_capacity = scheduler->systems_capacity ? scheduler->systems_capacity * 2 : 16;
+        scheduler->systems = realloc(scheduler->systems, sizeof(System) * scheduler->systems_capacity);
+        if(!scheduler->systems) exit(EXIT_FAILURE);
+    }
+    System* system = &scheduler->systems[scheduler->number_of_systems];
+    system->function = desc->function;
+    system->user_data = desc->user_data;
+    component_mask_init(&system->reads, desc->reads, desc->number_of_reads);
+    component_mask_init(&system->writes, desc->writes, desc->number_of_writes);
+    system->queries = malloc(sizeof(query_id_t) * (desc->number_of_queries ? desc->number_of_queries : 1));
+    if(!system->queries) exit(EXIT_FAILURE);
+    if (desc->number_of_queries) {
+        memcpy(system->queries, desc->queries, sizeof(query_id_t) * desc->number_of_queries);
+    }
+    system->number_of_queries = desc->number_of_queries;
+    system->exclusive = desc->exclusive;
+    scheduler->waves_outdated = true;
+    return scheduler->number_of_systems++;
+}
+
+//fetching a cached query's iterator updates the query, so two systems using one query never overlap
+static bool systems_share_query(const System* a, const System* b) {
+    for (uint32_t i = 0; i < a->number_of_queries; i++) {
+        for (uint32_t j = 0; j < b->number_of_queries; j++) {
+            if (a->queries[i] == b->queries[j]) {
+                return true;
             }
         }
     }
-    return iterator;
+    return false;
 }
 
-void component_iterator_destroy(ComponentIterator* iterator) {
-    if (iterator->component_field_arrays) {
-        for (chunks_length_t i = 0; i < iterator->number_of_chunks; i++) {
-            free(iterator->component_field_arrays[i]); // Free the inner array
+//two systems conflict when one writes what the other reads or writes, or both use the same cached query
+static bool systems_conflict(const System* a, const System* b) {
+    return a->exclusive || b->exclusive ||
+        component_mask_intersects(&a->writes, &b->writes) ||
+        component_mask_intersects(&a->writes, &b->reads) ||
+        component_mask_intersects(&a->reads, &b->writes) ||
+        systems_share_query(a, b);
+}
+
+static void scheduler_build_waves(Scheduler* scheduler) {
+    const uint32_t number_of_systems = scheduler->number_of_systems;
+    uint32_t* system_waves = malloc(sizeof(uint32_t) * (number_of_systems ? number_of_systems : 1));
+    if(!system_waves) exit(EXIT_FAILURE);
+
+    //longest path through the conflicts with earlier systems, so conflicting systems keep their order
+    uint32_t number_of_waves = 0;
+    for (uint32_t i = 0; i < number_of_systems; i++) {
+        uint32_t wave = 0;
+        for (uint32_t j = 0; j < i; j++) {
+            if (system_waves[j] >= wave && systems_conflict(&scheduler->systems[i], &scheduler->systems[j])) {
+                wave = system_waves[j] + 1;
+            }
+        }
+        system_waves[i] = wave;
+        if (wave + 1 > number_of_waves) {
+            number_of_waves = wave + 1;
         }
-        free(iterator->component_field_arrays); // Free the outer array
-        iterator->component_field_arrays = NULL;
     }
-    if (iterator->chunk_lengths) {
-        free(iterator->chunk_lengths);
-        iterator->chunk_lengths = NULL;
+
+    //counting sort by wave, registration order within a wave
+    free(scheduler->wave_begins);
+    scheduler->wave_begins = calloc(number_of_waves + 1, sizeof(uint32_t));
+    if(!scheduler->wave_begins) exit(EXIT_FAILURE);
+    for (uint32_t i = 0; i < number_of_systems; i++) {
+        scheduler->wave_begins[system_waves[i] + 1]++;
     }
-    iterator->number_of_chunks = 0;
-}
\ No newline at end of file
+    for (uint32_t w = 0; w < number_of_waves; w++) {
+        scheduler->wave_begins[w + 1] += scheduler->wave_begins[w];
+    }
+
+    free(scheduler->waves);
+    scheduler->waves = malloc(sizeof(uint32_t) * (number_of_systems ? number_of_systems : 1));
+    if(!scheduler->waves) exit(EXIT_FAILURE);
+    for (uint32_t i = 0; i < number_of_systems; i++) {
+        scheduler->waves[scheduler->wave_begins[system_waves[i]]++] = i;
+    }
+    //the placement loop moved every begin to the next wave's begin
+    for (uint32_t w = number_of_waves; w > 0; w--) {
+        scheduler->wave_begins[w] = scheduler->wave_begins[w - 1];
+    }
+    scheduler->wave_begins[0] = 0;
+
+    free(system_waves);
+    scheduler->number_of_waves = number_of_waves;
+    scheduler->waves_outdated = false;
+}
+
+static void scheduler_run_wave_job(const uint32_t job_index, void* user_data) {
+    const SchedulerWave* wave = user_data;
+    const System* system = &wave->scheduler->systems[wave->systems[job_index]];
+    system->function(wave->world, system->user_data);
+}
+
+void scheduler_run(Scheduler* scheduler, World* world, JobSystem* job_system) {
+    if (scheduler->waves_outdated) {
+        scheduler_build_waves(scheduler);
+    }
+    for (uint32_t w = 0; w < scheduler->number_of_waves; w++) {
+        const uint32_t begin = scheduler->wave_begins[w];
+        const uint32_t end = scheduler->wave_begins[w + 1];
+        if (!job_system || end - begin == 1) {
+            for (uint32_t s = begin; s < end; s++) {
+                const System* system = &scheduler->systems[scheduler->waves[s]];
+                system->function(world, system->user_data);
+            }
+            continue;
+        }
+        SchedulerWave wave = { .scheduler = scheduler, .systems = &scheduler->waves[begin], .world = world };
+        job_system_parallel_for(job_system, end - begin, scheduler_run_wave_job, &wave);
+    }
+}
+
+uint32_t scheduler_number_of_waves(const Scheduler* scheduler) {
+    return scheduler->number_of_waves;
+}
@@ -1,62 +1,366 @@
 #ifndef ECS_H
 #define ECS_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "jobs.h"
+
 #define CACHE_SIZE 64
 
+//widths of the archetype id, component id and field size types, each 8, 16 or 32 bits.
+//Every file including ecs.h has to be built with the same values.
+#ifndef ARCH_ID_BITS
+#define ARCH_ID_BITS 8
+#endif
+#ifndef COMP_ID_BITS
+#define COMP_ID_BITS 8
+#endif
+#ifndef COMP_SIZE_BITS
+#define COMP_SIZE_BITS 8
+#endif
+#define ECS_UINT_(bits) uint##bits##_t
+#define ECS_UINT(bits) ECS_UINT_(bits)
+
 typedef uint32_t id_t;
-typedef uint8_t comp_id_t;
-typedef uint8_t arch_id_t;
-typedef uint8_t comp_size_t;
+typedef ECS_UINT(COMP_ID_BITS) comp_id_t;
+typedef ECS_UINT(ARCH_ID_BITS) arch_id_t;
+typedef ECS_UINT(COMP_SIZE_BITS) comp_size_t;
+typedef uint16_t query_id_t;
+
+//an entity id is a slot index in the low bits and the slot's generation in the high bits,
+//the generation changes whenever the slot is freed so stale ids can be detected
+#ifndef ENTITY_INDEX_BITS
+#define ENTITY_INDEX_BITS 24
+#endif
+#if ENTITY_INDEX_BITS >= 24
+typedef uint8_t generation_t;
+#else
+typedef uint16_t generation_t;
+#endif
+#define ENTITY_INDEX_MASK ((id_t)((1u << ENTITY_INDEX_BITS) - 1))
+#define ENTITY_GENERATION_MASK ((id_t)((1u << (32 - ENTITY_INDEX_BITS)) - 1))
+#define ENTITY_INDEX(id) ((id_t)(id) & ENTITY_INDEX_MASK)
+#define ENTITY_GENERATION(id) ((generation_t)((id_t)(id) >> ENTITY_INDEX_BITS))
+#define ENTITY_ID(index, generation) ((((id_t)(generation)) << ENTITY_INDEX_BITS) | (id_t)(index))
 
 typedef uint32_t chunk_size_t;
 typedef uint32_t chunks_length_t;
 
+#define ARCH_ID_INVALID ((arch_id_t)-1)
+
+//masks have one bit per possible component id, wider ids default to 1024 components so
+//archetype and query masks stay small
+#ifndef MAX_COMPONENTS
+#if COMP_ID_BITS == 8
+#define MAX_COMPONENTS 256u
+#else
+#define MAX_COMPONENTS 1024u
+#endif
+#endif
+#if MAX_COMPONENTS > (1LL << COMP_ID_BITS)
+#error "MAX_COMPONENTS does not fit in COMP_ID_BITS"
+#endif
+#define COMPONENT_MASK_WORDS ((MAX_COMPONENTS + 63) / 64)
+
+typedef struct ComponentMask {
+    uint64_t words[COMPONENT_MASK_WORDS];
+} ComponentMask;
+
+typedef enum ComponentStorage {
+    //a column of the archetype table, part of the archetype's signature
+    COMPONENT_STORAGE_TABLE,
+    //a sparse set of its own, adding or removing it never moves the entity between archetypes
+    COMPONENT_STORAGE_SPARSE
+} ComponentStorage;
+
+//rows of one sparse component, packed and in no particular order
+typedef struct ComponentSet {
+    //position + 1 of each entity index's row, 0 where the entity does not have the component
+    id_t* positions;
+    id_t positions_capacity;
+    //entity index of positions[0], the first entity index of the world
+    id_t first_index;
+    id_t* ids;
+    //one array per field
+    void** fields;
+    id_t count;
+    id_t capacity;
+} ComponentSet;
+
 typedef struct ComponentData {
     comp_size_t number_of_fields;
     comp_size_t* field_sizes;
+    uint8_t storage;
+    //only used with COMPONENT_STORAGE_SPARSE
+    ComponentSet set;
 } ComponentData;
 
+//chunk memory comes from these callbacks, sizes are always a multiple of the alignment
+typedef struct ChunkAllocator {
+    void* (*allocate)(size_t size, size_t alignment, void* user_data);
+    void (*free)(void* memory, size_t size, void* user_data);
+    void* user_data;
+} ChunkAllocator;
+
+//released chunk blocks of one size, reused before asking the allocator again
+typedef struct ChunkPoolBucket {
+    void** blocks;
+    size_t block_size;
+    uint32_t number_of_blocks;
+    uint32_t capacity;
+} ChunkPoolBucket;
+
+typedef struct ChunkPool {
+    ChunkAllocator allocator;
+    ChunkPoolBucket* buckets;
+    uint32_t number_of_buckets;
+    //blocks in [foreign_begin, foreign_end) belong to a mapped snapshot and are dropped on release
+    const uint8_t* foreign_begin;
+    const uint8_t* foreign_end;
+} ChunkPool;
+
+//the id array, the field arrays and the column table all live in one block
 typedef struct ArchetypeDataChunk {
+    void* block;
     id_t* id_dense_array;
-    void*** component_field_arrays;
+    //one field array per column of the archetype
+    void** columns;
+    //world tick of the last write access to each column
+    uint32_t* column_ticks;
+    //world tick of the last time rows were added, removed or moved
+    uint32_t structure_tick;
+    //smallest and largest sort key of the rows, computed by world_sort at bounds_tick (0 for never).
+    //They hold while neither the rows nor the key component's columns changed after that tick.
+    uint32_t bounds_tick;
+    uint64_t key_min;
+    uint64_t key_max;
     chunk_size_t dense_arrays_length;
 } ArchetypeDataChunk;
 
+//row copies get one loop per field size 1, 2, 4, 8, 16 and 32 with a constant copy size,
+//the last class holds every other size
+#define ROW_COPY_CLASSES 7
+
+//archetypes reached by adding or removing one component, ARCH_ID_INVALID until first used
+typedef struct ArchetypeEdge {
+    comp_id_t component;
+    arch_id_t add;
+    arch_id_t remove;
+} ArchetypeEdge;
+
 typedef struct Archetype {
+    ComponentMask mask;
+    //sorted, a component's position here indexes component_columns
     comp_id_t* components;
+    //first column of each component, its fields take the columns that follow
+    uint32_t* component_columns;
+    comp_size_t* column_sizes;
+    uint32_t number_of_columns;
+    //every column once, grouped by size class; class k is [copy_plan_class_begin[k], copy_plan_class_begin[k + 1])
+    uint32_t* copy_plan;
+    uint32_t copy_plan_class_begin[ROW_COPY_CLASSES + 1];
     ArchetypeDataChunk* chunks;
+    //stack of the chunks that still have space, the top one receives new entities
+    chunks_length_t* free_chunks;
     chunks_length_t number_of_chunks;
+    chunks_length_t chunks_capacity;
+    chunks_length_t number_of_free_chunks;
+    ArchetypeEdge* edges;
+    comp_id_t number_of_edges;
     chunk_size_t chunk_size;
+    size_t chunk_block_size;
+    //index of the world's sort key that orders the rows, UINT32_MAX for unsorted archetypes
+    uint32_t sort_key;
+    //tick of the last world_sort that ordered the rows
+    uint32_t sort_tick;
     comp_id_t number_of_components;
     arch_id_t archetype_id;
 } Archetype;
 
+//everything a lookup needs in one record, so it touches a single cache line
+typedef struct SparseEntry {
+    id_t dense_id_array_index;
+    chunks_length_t chunk_index;
+    //ARCH_ID_INVALID for free slots
+    arch_id_t archetype;
+    generation_t generation;
+} SparseEntry;
+
 typedef struct SparseArrayChunk {
+    SparseEntry* entries;
+} SparseArrayChunk;
+
+typedef struct ComponentIterator {
+    void**** component_field_arrays;
+    chunk_size_t* chunk_lengths;
+    chunks_length_t number_of_chunks;
+} ComponentIterator;
+
+//a row's sort key from the fields of the key component at that row, e.g. a Morton code of a position
+typedef uint64_t (*SortKeyFunction)(void* const* fields, chunk_size_t row, void* user_data);
+
+typedef struct SortKeyDesc {
+    comp_id_t component;
+    //NULL reads the field as an unsigned integer of its size, which has to be 1, 2, 4 or 8 bytes
+    SortKeyFunction function;
+    void* user_data;
+    comp_size_t field;
+} SortKeyDesc;
+
+//an archetype matches when it has every required component, none of the excluded ones and,
+//if any_of is not empty, at least one of any_of. The iterator columns are the required, then the
+//optional, then the any_of components; optional and any_of columns are NULL where the archetype lacks them.
+typedef struct QueryDesc {
+    const comp_id_t* required;
+    const comp_id_t* excluded;
+    const comp_id_t* optional;
+    const comp_id_t* any_of;
+    //components the caller writes through the iterator, their columns get the current tick
+    const comp_id_t* written;
+    comp_id_t number_of_required;
+    comp_id_t number_of_excluded;
+    comp_id_t number_of_optional;
+    comp_id_t number_of_any_of;
+    comp_id_t number_of_written;
+    //when not 0 world_get_filtered_iterator skips the chunks whose rows and query columns
+    //have not changed after this tick, cached queries ignore it
+    uint32_t changed_since;
+    //when set, chunks sorted by sort_key whose key bounds lie outside [key_min, key_max] are skipped.
+    //Chunks without valid bounds are kept. Cached queries ignore it.
+    bool cull_by_key;
+    uint32_t sort_key;
+    uint64_t key_min;
+    uint64_t key_max;
+} QueryDesc;
+
+//the masks of a QueryDesc, matched against archetype masks
+typedef struct QueryFilter {
+    ComponentMask required;
+    ComponentMask excluded;
+    ComponentMask any_of;
+    bool has_any_of;
+} QueryFilter;
+
+//most columns a QueryIter can hold
+#ifndef QUERY_ITER_MAX_COLUMNS
+#define QUERY_ITER_MAX_COLUMNS 16
+#endif
+
+//walks the matching chunks one at a time without allocating, lives wherever the caller puts it.
+//After query_iter_next_chunk returned true, columns, length and the chunk location describe the chunk.
+typedef struct QueryIter {
+    void** columns[QUERY_ITER_MAX_COLUMNS];
+    chunk_size_t length;
+    arch_id_t archetype_id;
+    chunks_length_t chunk_index;
+
+    //World is declared below
+    const struct World* world;
+    QueryFilter filter;
+    comp_id_t components[QUERY_ITER_MAX_COLUMNS];
+    //first column of each component in the current archetype, UINT32_MAX where it is absent
+    uint32_t first_columns[QUERY_ITER_MAX_COLUMNS];
+    uint32_t changed_since;
+    bool cull_by_key;
+    uint32_t sort_key;
+    uint64_t key_min;
+    uint64_t key_max;
+    comp_id_t number_of_components;
+    //archetype and chunk the next call looks at
+    arch_id_t next_archetype;
+    chunks_length_t next_chunk;
+} QueryIter;
+
+//a query remembers the chunks of its matching archetypes so iterating it needs no allocation
+typedef struct Query {
+    QueryFilter filter;
+    comp_id_t* components;
+    comp_id_t* written;
     arch_id_t* archetypes;
+    //location of every cached chunk, used to refresh the chunk lengths
+    arch_id_t* chunk_archetypes;
     chunks_length_t* chunk_indexes;
-    id_t* dense_id_array_indexes;
-} SparseArrayChunk;
+    void*** column_table;
+    ComponentIterator iterator;
+    chunks_length_t chunk_capacity;
+    //calls of world_get_query_iterator and the rows they returned, reported by world_get_stats
+    uint64_t number_of_iterations;
+    uint64_t rows_iterated;
+    comp_id_t number_of_components;
+    comp_id_t number_of_written;
+    arch_id_t number_of_archetypes;
+} Query;
 
 typedef struct World {
     Archetype* archetypes;
+    //released indexes, the top one is reused first
     id_t* id_stack_ids;
     id_t id_stack_capacity;
     id_t id_stack_top_index;
+    //slots below it have been handed out before, the ones above are taken in order once the stack is empty
+    id_t next_entity_slot;
     comp_id_t* component_ids;
     ComponentData* all_components_data;
+    //the components with COMPONENT_STORAGE_SPARSE, their rows go when the entity is removed
+    comp_id_t* sparse_components;
+    comp_id_t number_of_sparse_components;
+    Query* queries;
+    //an archetype is sorted by the first of these whose component it has
+    SortKeyDesc* sort_keys;
+    uint32_t number_of_sort_keys;
+    //open addressing table from component mask to archetype, empty slots hold ARCH_ID_INVALID
+    arch_id_t* archetype_lookup;
+    uint32_t archetype_lookup_capacity;
 
+    //page directory of the sparse array, a page is allocated when the first slot in it is handed out
+    //and never moves, pages that are not allocated yet have NULL entries
     SparseArrayChunk* sparse_array_chunks;
+    //always a power of two, slots are found with a shift and a mask
     const chunk_size_t sparse_array_chunk_size;
+    const uint32_t sparse_array_chunk_shift;
     chunks_length_t starting_sparse_array_chunks;
     chunks_length_t sparse_array_number_of_chunks;
+    chunks_length_t sparse_array_chunks_capacity;
+    //the world only hands out entity indexes in [first_entity_index, first_entity_index + number_of_entity_indexes),
+    //sparse slot 0 belongs to first_entity_index
+    const id_t first_entity_index;
+    const id_t number_of_entity_indexes;
 
     const chunk_size_t dense_array_chunk_size;
+    const size_t chunk_byte_budget;
+    ChunkPool chunk_pool;
     arch_id_t number_of_archetypes;
     comp_id_t number_of_components;
+    query_id_t number_of_queries;
+    //archetype world_compact_step continues with
+    arch_id_t compact_cursor;
+    //stamped on chunks by writes and structural changes, starts at 1
+    uint32_t change_tick;
+    //snapshot file the chunk blocks of a loaded world point into, NULL otherwise
+    void* mapping;
+    size_t mapping_size;
 } World;
 
+typedef struct WorldConfig {
+    chunk_size_t dense_array_chunk_size;
+    chunk_size_t sparse_array_chunk_size;
+    chunks_length_t starting_sparse_array_chunks;
+    //when not 0 every archetype fits as many rows as this many bytes allow
+    //instead of dense_array_chunk_size rows
+    size_t chunk_byte_budget;
+    //NULL uses the aligned system allocator
+    const ChunkAllocator* chunk_allocator;
+    //worlds with disjoint index ranges never create the same entity id, so entities can move between
+    //them without colliding. number_of_entity_indexes 0 means up to the last possible index,
+    //running out of indexes exits the process.
+    id_t first_entity_index;
+    id_t number_of_entity_indexes;
+} WorldConfig;
+
+World world_create_with_config(const WorldConfig* config);
+
 World world_create(
     const chunk_size_t dense_array_chunk_size,
     const chunk_size_t sparse_array_chunk_size,
@@ -65,27 +369,430 @@ World world_create(
 
 void world_destroy(World* world);
 
+//writes the components, archetypes with their chunk blocks, sparse array and id stack to one file,
+//false if the file cannot be written. Queries are not saved.
+bool world_save(const World* world, const char* path);
+
+//maps a file written by world_save copy-on-write, the chunk blocks stay in the mapping so the file
+//must not change until world_destroy. False for unreadable, truncated or inconsistent files and files saved with
+//other widths. chunk_allocator may be NULL and is used for every chunk created after loading.
+bool world_load(World* out_world, const char* path, const ChunkAllocator* chunk_allocator);
+
+//bytes of a delta, reused from frame to frame
+typedef struct DeltaBuffer {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} DeltaBuffer;
+
+DeltaBuffer delta_buffer_create(void);
+
+void delta_buffer_destroy(DeltaBuffer* buffer);
+
+//replaces the buffer's contents with every chunk changed after since_tick: whole chunks where rows were
+//added, removed or moved, single columns where only fields were written. Sparse components are not included.
+void world_write_delta(const World* world, uint32_t since_tick, DeltaBuffer* buffer);
+
+//makes the chunks of a replica match the sender's, entities that left the sent chunks are removed.
+//The replica needs the same component types and must not change its structure on its own.
+//False if the delta is malformed or does not fit the replica, which may then be partly updated.
+bool world_apply_delta(World* replica, const void* data, size_t size);
+
 comp_id_t world_add_component_type(World* world, const comp_size_t* field_sizes, comp_size_t number_of_fields);
 
+//sparse components are left out of archetype signatures and cannot be part of a QueryDesc,
+//iterate their set with world_get_component_set and look up the rest per entity instead
+comp_id_t world_add_component_type_with_storage(
+    World* world,
+    const comp_size_t* field_sizes,
+    comp_size_t number_of_fields,
+    ComponentStorage storage
+);
+
+//NULL for table components
+const ComponentSet* world_get_component_set(const World* world, const comp_id_t component_id);
+
+bool world_has_component(const World* world, const id_t entity_id, const comp_id_t component_id);
+
 id_t world_add_entity(World* world, comp_id_t number_of_components, const comp_id_t* components);
 
+//rows [begin, end) of one chunk that a bulk spawn filled
+typedef struct ChunkRange {
+    arch_id_t archetype_id;
+    chunks_length_t chunk_index;
+    chunk_size_t begin;
+    chunk_size_t end;
+} ChunkRange;
+
+//spawns number_of_entities entities of one archetype, out_ids may be NULL,
+//if out_ranges is not NULL it receives a malloc'd array of the filled ranges that the caller frees
+chunks_length_t world_add_entities(
+    World* world,
+    const id_t number_of_entities,
+    const comp_id_t number_of_components,
+    const comp_id_t* components,
+    id_t* out_ids,
+    ChunkRange** out_ranges
+);
+
+//base address of one field array of a chunk, row i of the chunk lives at index i.
+//The column counts as written at the current tick.
+void* world_get_chunk_field(
+    World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const comp_id_t component_id,
+    const comp_size_t field_index
+);
+
+//all field arrays of one component in a chunk, NULL if the archetype does not have the component.
+//Does not touch the change ticks, call world_mark_chunk_changed after writing through them.
+void** world_get_chunk_component_fields(
+    const World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const comp_id_t component_id
+);
+
+//false for removed entities, including ids whose slot has been reused since
+bool world_is_alive(const World* world, const id_t entity_id);
+
+//where a live entity's row is, false for stale or removed ids
+bool world_get_entity_location(
+    const World* world,
+    const id_t entity_id,
+    arch_id_t* archetype_id,
+    chunks_length_t* chunk_index,
+    chunk_size_t* row
+);
+
 void world_remove_entity(World* world, const id_t entity_id);
 
+//removes many entities at once, ids listed twice are removed once
+void world_remove_entities(World* world, const id_t* entity_ids, const id_t number_of_entities);
+
+//moves the entities with all their components to another world and returns how many were moved,
+//stale ids are skipped and ids listed twice are moved once. The moved entities get new ids from the target's
+//index range, written to out_ids (if not NULL) in the order of entity_ids, once per listing.
+//component_remap[c] is the target's id of the source's component c with the same fields,
+//NULL if both worlds registered the same components in the same order. Nothing moves and 0 is returned
+//when a component the entities have maps to one with other fields.
+id_t world_transfer_entities(
+    World* source,
+    World* target,
+    const id_t* entity_ids,
+    id_t number_of_entities,
+    const comp_id_t* component_remap,
+    id_t* out_ids);
+
+//removes every entity that has all of the components, which must be table components
+void world_clear_query(World* world, const comp_id_t* component_ids, const comp_id_t number_of_components);
+
+//moves rows out of sparse chunks into fuller ones and frees the empty chunks, entity ids stay valid
+void world_compact(World* world);
+
+//same as world_compact but moves at most row_budget rows per call, returns true once there is nothing left to do
+bool world_compact_step(World* world, uint32_t row_budget);
+
+//moves the entity to the archetype with/without the component, the entity keeps its id
+//and the fields of a newly added component are left uninitialized. Sparse components only
+//insert or remove the entity's row in their set.
+void world_add_component(World* world, const id_t entity_id, const comp_id_t component_id);
+
+void world_remove_component(World* world, const id_t entity_id, const comp_id_t component_id);
+
+//the column counts as written at the current tick
 void* world_get_component_field(
+    World* world,
+    const id_t entity_id,
+    const comp_id_t component_id,
+    const comp_size_t field_index
+);
+
+//world_get_component_field for reading, writes nothing to the world. Systems that only read a component
+//use this one, so that several of them can run in one wave.
+const void* world_read_component_field(
     const World* world,
     const id_t entity_id,
     const comp_id_t component_id,
     const comp_size_t field_index
 );
 
-typedef struct ComponentIterator {
-    void**** component_field_arrays;
-    chunk_size_t* chunk_lengths;
-    chunks_length_t number_of_chunks;
-} ComponentIterator;
+//world_get_component_field for many entities, out_fields[i] is NULL where the single lookup would be.
+//Sparse entries are prefetched ahead and the column is resolved once per run of entities in one archetype.
+void world_get_component_fields(
+    World* world,
+    const id_t* entity_ids,
+    const id_t number_of_entities,
+    const comp_id_t component_id,
+    const comp_size_t field_index,
+    void** out_fields
+);
 
 ComponentIterator world_get_component_iterator(const World* world, const comp_id_t* component_ids, const comp_id_t number_of_components);
 
+ComponentIterator world_get_filtered_iterator(World* world, const QueryDesc* desc);
+
 void component_iterator_destroy(ComponentIterator* iterator);
 
+//written is ignored, the iterator never touches change ticks or allocates, and needs no destroy
+void query_iter_begin(QueryIter* iter, const World* world, const QueryDesc* desc);
+
+//moves to the next non-empty matching chunk, false once there is none left
+bool query_iter_next_chunk(QueryIter* iter);
+
+query_id_t world_add_query(World* world, const comp_id_t* component_ids, const comp_id_t number_of_components);
+
+query_id_t world_add_filtered_query(World* world, const QueryDesc* desc);
+
+//the returned iterator is owned by the query, do not pass it to component_iterator_destroy.
+//The query's written columns count as written at the current tick in every chunk.
+const ComponentIterator* world_get_query_iterator(World* world, const query_id_t query_id);
+
+uint32_t world_get_tick(const World* world);
+
+//starts a new tick and returns it. An incremental system remembers the tick it ran at, advances it
+//and passes the remembered tick as changed_since next time.
+uint32_t world_advance_tick(World* world);
+
+//marks every field of the component in one chunk as written at the current tick
+void world_mark_chunk_changed(World* world, const arch_id_t archetype_id, const chunks_length_t chunk_index, const comp_id_t component_id);
+
+//true if rows of the chunk were added, removed or moved, or a field of the component was written, after tick
+bool world_chunk_changed_since(
+    const World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    const comp_id_t component_id,
+    const uint32_t tick
+);
+
+typedef struct ArchetypeStats {
+    id_t number_of_entities;
+    chunks_length_t number_of_chunks;
+    chunk_size_t chunk_size;
+    comp_id_t number_of_components;
+    //entities over the rows of all chunks, 0 without chunks
+    double fill_ratio;
+    //chunk blocks, and the id and field bytes of the live rows in them
+    size_t bytes_allocated;
+    size_t bytes_used;
+} ArchetypeStats;
+
+typedef struct QueryStats {
+    uint64_t number_of_iterations;
+    uint64_t rows_iterated;
+    arch_id_t number_of_archetypes;
+    chunks_length_t number_of_chunks;
+} QueryStats;
+
+//indexed by arch_id_t and query_id_t, release with world_stats_destroy
+typedef struct WorldStats {
+    ArchetypeStats* archetypes;
+    QueryStats* queries;
+    arch_id_t number_of_archetypes;
+    query_id_t number_of_queries;
+    id_t number_of_entities;
+    //sums over the archetypes
+    size_t chunk_bytes_allocated;
+    size_t chunk_bytes_used;
+    //released blocks the pool keeps for reuse
+    size_t chunk_pool_bytes;
+    //allocated pages and the page directory
+    size_t sparse_array_bytes;
+    //positions, ids and fields of the sparse component sets
+    size_t sparse_component_bytes;
+    //released ids waiting for reuse
+    id_t id_stack_size;
+    size_t id_stack_bytes;
+} WorldStats;
+
+//walks every archetype and chunk once, meant for tools and periodic logging rather than every frame
+WorldStats world_get_stats(const World* world);
+
+void world_stats_destroy(WorldStats* stats);
+
+//every archetype with the key's component and no earlier key keeps its rows ordered by it once world_sort ran,
+//returns the key's index for QueryDesc.sort_key. Keys are not saved in snapshots.
+uint32_t world_add_sort_key(World* world, const SortKeyDesc* desc);
+
+//orders the rows of every sorted archetype whose rows or key columns changed since its last sort, across all
+//of its chunks, and recomputes the chunk key bounds. Entity ids stay valid. Starts a new tick and returns it.
+uint32_t world_sort(World* world);
+
+//false if the chunk is not sorted or its bounds are out of date
+bool world_get_chunk_key_bounds(
+    const World* world,
+    const arch_id_t archetype_id,
+    const chunks_length_t chunk_index,
+    uint64_t* out_key_min,
+    uint64_t* out_key_max
+);
+
+//interleaves the low 32 bits of x and y, or the low 21 bits of x, y and z
+uint64_t morton_code_2d(uint32_t x, uint32_t y);
+
+uint64_t morton_code_3d(uint32_t x, uint32_t y, uint32_t z);
+
+typedef void (*ChunkCallback)(void*** component_field_arrays, chunk_size_t begin, chunk_size_t end, void* user_data);
+
+//rows_per_job of 0 picks a split based on the number of threads
+void world_query_for_each_parallel(
+    const World* world,
+    JobSystem* job_system,
+    const comp_id_t* component_ids,
+    const comp_id_t number_of_components,
+    ChunkCallback callback,
+    void* user_data,
+    chunk_size_t rows_per_job
+);
+
+void world_query_for_each_parallel_cached(
+    World* world,
+    JobSystem* job_system,
+    const query_id_t query_id,
+    ChunkCallback callback,
+    void* user_data,
+    chunk_size_t rows_per_job
+);
+
+typedef enum CommandType {
+    COMMAND_CREATE_ENTITY,
+    COMMAND_DESTROY_ENTITY,
+    COMMAND_ADD_COMPONENT,
+    COMMAND_REMOVE_COMPONENT
+} CommandType;
+
+typedef struct Command {
+    //for COMMAND_CREATE_ENTITY this is the index into created_ids
+    id_t entity_id;
+    uint32_t order;
+    uint32_t components_offset;
+    //the component to add or remove, or the number of components of a create
+    comp_id_t component;
+    arch_id_t archetype_id;
+    uint8_t type;
+} Command;
+
+//records structural changes to apply later, one buffer per thread needs no locking
+typedef struct CommandBuffer {
+    Command* commands;
+    uint32_t number_of_commands;
+    uint32_t commands_capacity;
+    comp_id_t* component_storage;
+    uint32_t component_storage_length;
+    uint32_t component_storage_capacity;
+    //ids of the entities created by the last flush, indexed by what command_buffer_create_entity returned
+    id_t* created_ids;
+    uint32_t number_of_creates;
+    uint32_t created_ids_capacity;
+} CommandBuffer;
+
+CommandBuffer command_buffer_create(void);
+
+void command_buffer_destroy(CommandBuffer* buffer);
+
+uint32_t command_buffer_create_entity(CommandBuffer* buffer, const comp_id_t number_of_components, const comp_id_t* components);
+
+void command_buffer_destroy_entity(CommandBuffer* buffer, const id_t entity_id);
+
+void command_buffer_add_component(CommandBuffer* buffer, const id_t entity_id, const comp_id_t component_id);
+
+void command_buffer_remove_component(CommandBuffer* buffer, const id_t entity_id, const comp_id_t component_id);
+
+//applies and clears the recorded commands: component changes, then destroys, then creates
+void world_flush_commands(World* world, CommandBuffer* buffer);
+
+//spawning from several threads at once. Each stage belongs to one thread at a time, reserves blocks of
+//ids with one atomic add and fills staging chunks of its own. world_end_spawn_phase publishes the staged
+//chunks into the archetypes. Until then the world may be read but not changed, and staged entities are not alive.
+typedef struct SpawnPhase SpawnPhase;
+
+//rows [begin, end) of one staging chunk
+typedef struct SpawnRange {
+    //layout of the staging chunk, the same as the world's archetype
+    const Archetype* archetype;
+    void** columns;
+    chunk_size_t begin;
+    chunk_size_t end;
+} SpawnRange;
+
+SpawnPhase* world_begin_spawn_phase(World* world, uint32_t number_of_stages);
+
+//world_add_entities on the given stage, thread-safe as long as no other thread uses the same stage.
+//The chunk allocator must be thread-safe, the default one is.
+chunks_length_t spawn_phase_add_entities(
+    SpawnPhase* phase,
+    uint32_t stage,
+    id_t number_of_entities,
+    comp_id_t number_of_components,
+    const comp_id_t* components,
+    id_t* out_ids,
+    SpawnRange** out_ranges);
+
+//the field arrays of a table component in a staged range, NULL if the range lacks it
+void** spawn_range_component_fields(const SpawnRange* range, comp_id_t component_id);
+
+//publishes every stage in stage order and frees the phase
+void world_end_spawn_phase(World* world, SpawnPhase* phase);
+
+typedef void (*SystemFunction)(World* world, void* user_data);
+
+//the components a system reads and writes. Exclusive systems may change the world's structure,
+//flush commands or advance the tick, they run alone.
+//Systems that only read a component share a wave, so reads must not write to the world: use
+//world_read_component_field, world_get_chunk_component_fields, Name_get or iterators without written
+//components. world_get_component_field, world_get_chunk_field, Name_set and written query components
+//stamp change ticks and count as writes. world_get_query_iterator updates its cached query, so every
+//cached query a system fetches is listed in queries and two systems listing the same query conflict.
+typedef struct SystemDesc {
+    SystemFunction function;
+    void* user_data;
+    const comp_id_t* reads;
+    const comp_id_t* writes;
+    comp_id_t number_of_reads;
+    comp_id_t number_of_writes;
+    bool exclusive;
+    const query_id_t* queries;
+    query_id_t number_of_queries;
+} SystemDesc;
+
+typedef struct System {
+    SystemFunction function;
+    void* user_data;
+    ComponentMask reads;
+    ComponentMask writes;
+    query_id_t* queries;
+    query_id_t number_of_queries;
+    bool exclusive;
+} System;
+
+//runs systems in registration order as far as their accesses conflict. A system goes into the wave after
+//the last earlier system it conflicts with, the systems of one wave run at the same time.
+typedef struct Scheduler {
+    System* systems;
+    uint32_t number_of_systems;
+    uint32_t systems_capacity;
+    //system indexes grouped by wave, wave w is waves[wave_begins[w]] to waves[wave_begins[w + 1]]
+    uint32_t* waves;
+    uint32_t* wave_begins;
+    uint32_t number_of_waves;
+    //set by scheduler_add_system, the waves are rebuilt by the next run
+    bool waves_outdated;
+} Scheduler;
+
+Scheduler scheduler_create(void);
+
+void scheduler_destroy(Scheduler* scheduler);
+
+//returns the system's index. reads, writes and queries are copied, a component in both counts as written.
+uint32_t scheduler_add_system(Scheduler* scheduler, const SystemDesc* desc);
+
+//runs every system once. Waves with several systems run them as jobs, nested parallel queries then run
+//inline; a wave with one system runs it on the calling thread. job_system NULL runs everything in order.
+void scheduler_run(Scheduler* scheduler, World* world, JobSystem* job_system);
+
+//number of waves of the last run, 0 before the first run
+uint32_t scheduler_number_of_waves(const Scheduler* scheduler);
+
 #endif //ECS_H
\ No newline at end of file
@@ -0,0 +1,123 @@
+#ifndef ECS_TYPED_H
+#define ECS_TYPED_H
+
+#include "ecs.h"
+
+//Typed component access generated from one field list.
+//
+//  #define POSITION_FIELDS(X) X(float, x) X(float, y) X(float, z)
+//  ECS_COMPONENT(Position, POSITION_FIELDS)
+//
+//declares the row struct Position, the column struct PositionColumns (one typed pointer per field)
+//and static inline functions prefixed with Position_. Every field size is a compile-time constant,
+//so loops over the columns get constant strides and row copies need no runtime field sizes.
+//Components without fields (tags) are registered with world_add_component_type directly.
+
+#define ECS_ROW_MEMBER_(type, name) type name;
+#define ECS_COLUMN_MEMBER_(type, name) type* name;
+#define ECS_COUNT_FIELD_(type, name) + 1
+#define ECS_FIELD_SIZE_(type, name) (comp_size_t)sizeof(type),
+#define ECS_CHECK_FIELD_SIZE_(type, name) \
+    _Static_assert(sizeof(type) < (1ull << COMP_SIZE_BITS), "field " #name " does not fit comp_size_t, raise COMP_SIZE_BITS");
+#define ECS_BIND_COLUMN_(type, name) columns.name = (type*)fields[field++];
+#define ECS_OFFSET_COLUMN_(type, name) columns.name += row;
+#define ECS_LOAD_FIELD_(type, name) value.name = columns->name[row];
+#define ECS_STORE_FIELD_(type, name) columns->name[row] = value->name;
+#define ECS_COPY_FIELD_(type, name) target->name[target_row] = source->name[source_row];
+
+#define ECS_COMPONENT(Name, FIELDS)                                                                     \
+    typedef struct Name { FIELDS(ECS_ROW_MEMBER_) } Name;                                               \
+    typedef struct Name##Columns { FIELDS(ECS_COLUMN_MEMBER_) } Name##Columns;                          \
+    enum { Name##_number_of_fields = 0 FIELDS(ECS_COUNT_FIELD_) };                                      \
+                                                                                                        \
+    static inline comp_id_t Name##_register(World* world) {                                             \
+        FIELDS(ECS_CHECK_FIELD_SIZE_)                                                                   \
+        const comp_size_t field_sizes[] = { FIELDS(ECS_FIELD_SIZE_) };                                  \
+        return world_add_component_type(world, field_sizes, Name##_number_of_fields);                   \
+    }                                                                                                   \
+                                                                                                        \
+    /*binds the field arrays of one component, as found in ComponentIterator and ChunkCallback*/        \
+    static inline Name##Columns Name##_columns(void** fields) {                                         \
+        Name##Columns columns;                                                                          \
+        comp_size_t field = 0;                                                                          \
+        FIELDS(ECS_BIND_COLUMN_)                                                                        \
+        (void)field;                                                                                    \
+        return columns;                                                                                 \
+    }                                                                                                   \
+                                                                                                        \
+    /*term is the position of the component in the list the iterator was created with*/                \
+    static inline Name##Columns Name##_iterator_columns(                                                \
+        const ComponentIterator* iterator, const chunks_length_t chunk, const comp_id_t term) {         \
+        return Name##_columns(iterator->component_field_arrays[chunk][term]);                           \
+    }                                                                                                   \
+                                                                                                        \
+    /*false if the chunk's archetype does not have the component*/                                      \
+    static inline bool Name##_chunk_columns(                                                            \
+        const World* world, const arch_id_t archetype_id, const chunks_length_t chunk_index,            \
+        const comp_id_t component_id, Name##Columns* out_columns) {                                     \
+        void** fields = world_get_chunk_component_fields(world, archetype_id, chunk_index, component_id);\
+        if (!fields) {                                                                                  \
+            return false;                                                                               \
+        }                                                                                               \
+        *out_columns = Name##_columns(fields);                                                          \
+        return true;                                                                                    \
+    }                                                                                                   \
+                                                                                                        \
+    static inline Name Name##_load(const Name##Columns* columns, const chunk_size_t row) {              \
+        Name value;                                                                                     \
+        FIELDS(ECS_LOAD_FIELD_)                                                                         \
+        return value;                                                                                   \
+    }                                                                                                   \
+                                                                                                        \
+    static inline void Name##_store(const Name##Columns* columns, const chunk_size_t row, const Name* value) {\
+        FIELDS(ECS_STORE_FIELD_)                                                                        \
+    }                                                                                                   \
+                                                                                                        \
+    static inline void Name##_copy_row(                                                                 \
+        const Name##Columns* target, const chunk_size_t target_row,                                     \
+        const Name##Columns* source, const chunk_size_t source_row) {                                   \
+        FIELDS(ECS_COPY_FIELD_)                                                                         \
+    }                                                                                                   \
+                                                                                                        \
+    /*columns offset to the entity's row, so columns.x[0] is the entity's x. One location lookup       \
+      for all fields, false for stale ids or entities without the component*/                           \
+    static inline bool Name##_entity_columns(                                                           \
+        const World* world, const id_t entity_id, const comp_id_t component_id, Name##Columns* out_columns) {\
+        arch_id_t archetype_id;                                                                         \
+        chunks_length_t chunk_index;                                                                    \
+        chunk_size_t row;                                                                               \
+        if (!world_get_entity_location(world, entity_id, &archetype_id, &chunk_index, &row) ||          \
+            !Name##_chunk_columns(world, archetype_id, chunk_index, component_id, out_columns)) {       \
+            return false;                                                                               \
+        }                                                                                               \
+        Name##Columns columns = *out_columns;                                                           \
+        FIELDS(ECS_OFFSET_COLUMN_)                                                                      \
+        *out_columns = columns;                                                                         \
+        return true;                                                                                    \
+    }                                                                                                   \
+                                                                                                        \
+    static inline bool Name##_get(const World* world, const id_t entity_id, const comp_id_t component_id, Name* out_value) {\
+        Name##Columns columns;                                                                          \
+        if (!Name##_entity_columns(world, entity_id, component_id, &columns)) {                         \
+            return false;                                                                               \
+        }                                                                                               \
+        *out_value = Name##_load(&columns, 0);                                                          \
+        return true;                                                                                    \
+    }                                                                                                   \
+                                                                                                        \
+    /*the chunk's columns of the component count as written at the current tick*/                     \
+    static inline bool Name##_set(World* world, const id_t entity_id, const comp_id_t component_id, const Name* value) {\
+        arch_id_t archetype_id;                                                                         \
+        chunks_length_t chunk_index;                                                                    \
+        chunk_size_t row;                                                                               \
+        Name##Columns columns;                                                                          \
+        if (!world_get_entity_location(world, entity_id, &archetype_id, &chunk_index, &row) ||          \
+            !Name##_chunk_columns(world, archetype_id, chunk_index, component_id, &columns)) {          \
+            return false;                                                                               \
+        }                                                                                               \
+        Name##_store(&columns, row, value);                                                             \
+        world_mark_chunk_changed(world, archetype_id, chunk_index, component_id);                       \
+        return true;                                                                                    \
+    }
+
+#endif //ECS_TYPED_H
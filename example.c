@@ -3,10 +3,15 @@
 #include <math.h>
 #include "timer.h"
 #include "ecs.h"
+#include "ecs_typed.h"
 
 #define ENTITY_COUNT 1000000
 volatile double g_sink = 0.0;
 
+// Typed view of the position component, same layout as pos_fields below
+#define POSITION_FIELDS(X) X(double, x) X(double, y) X(double, z)
+ECS_COMPONENT(Position, POSITION_FIELDS)
+
 int main() {
     // Create world
     World world = world_create(1000000, 1000000, 1);
@@ -20,9 +25,7 @@ int main() {
 
     // Create entities with pos+vel
     comp_id_t comps[] = {pos_id, vel_id};
-    for (size_t i = 0; i < ENTITY_COUNT; i++) {
-        world_add_entity(&world, 2, comps);
-    }
+    world_add_entities(&world, ENTITY_COUNT, 2, comps, NULL, NULL);
 
     // Get iterator for (pos, vel)
     ComponentIterator it = world_get_component_iterator(&world, comps, 2);
@@ -68,6 +71,13 @@ int main() {
     }
 
     stop_timer();
+
+    // Typed access reads the same columns
+    if (it.number_of_chunks > 0) {
+        const PositionColumns columns = Position_iterator_columns(&it, 0, 0);
+        const Position first = Position_load(&columns, 0);
+        printf("First position: %f %f %f\n", first.x, first.y, first.z);
+    }
     component_iterator_destroy(&it);
 
     // Prevent optimization
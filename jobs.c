@@ -0,0 +1,314 @@
+#include "jobs.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define THREAD_LOCAL __declspec(thread)
+
+static void mutex_init(mutex_t* mutex) { InitializeCriticalSection(mutex); }
+static void mutex_destroy(mutex_t* mutex) { DeleteCriticalSection(mutex); }
+static void mutex_lock(mutex_t* mutex) { EnterCriticalSection(mutex); }
+static void mutex_unlock(mutex_t* mutex) { LeaveCriticalSection(mutex); }
+static void cond_init(cond_t* cond) { InitializeConditionVariable(cond); }
+static void cond_destroy(cond_t* cond) { (void)cond; }
+static void cond_wait(cond_t* cond, mutex_t* mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+static void cond_broadcast(cond_t* cond) { WakeAllConditionVariable(cond); }
+static void thread_yield(void) { SwitchToThread(); }
+
+static uint32_t hardware_concurrency(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define THREAD_LOCAL _Thread_local
+
+static void mutex_init(mutex_t* mutex) { pthread_mutex_init(mutex, NULL); }
+static void mutex_destroy(mutex_t* mutex) { pthread_mutex_destroy(mutex); }
+static void mutex_lock(mutex_t* mutex) { pthread_mutex_lock(mutex); }
+static void mutex_unlock(mutex_t* mutex) { pthread_mutex_unlock(mutex); }
+static void cond_init(cond_t* cond) { pthread_cond_init(cond, NULL); }
+static void cond_destroy(cond_t* cond) { pthread_cond_destroy(cond); }
+static void cond_wait(cond_t* cond, mutex_t* mutex) { pthread_cond_wait(cond, mutex); }
+static void cond_broadcast(cond_t* cond) { pthread_cond_broadcast(cond); }
+static void thread_yield(void) { sched_yield(); }
+
+static uint32_t hardware_concurrency(void) {
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+#endif
+
+//a queue is the range [head, tail) of job indexes packed in one word,
+//the owner pops from the head and thieves take the upper half from the tail
+#define RANGE_PACK(head, tail) (((uint64_t)(tail) << 32) | (uint64_t)(head))
+#define RANGE_HEAD(range) ((uint32_t)(range))
+#define RANGE_TAIL(range) ((uint32_t)((range) >> 32))
+
+//padded so that two queues never share a cache line
+#define JOB_QUEUE_SIZE 128
+
+typedef struct JobQueue {
+    _Atomic uint64_t range;
+    uint8_t padding[JOB_QUEUE_SIZE - sizeof(uint64_t)];
+} JobQueue;
+
+typedef struct JobWorker {
+    JobSystem* job_system;
+    uint32_t queue_index;
+} JobWorker;
+
+struct JobSystem {
+    thread_t* threads;
+    JobWorker* workers;
+    //one queue per thread, queue 0 belongs to the thread calling job_system_parallel_for
+    JobQueue* queues;
+    uint32_t number_of_threads;
+
+    mutex_t mutex;
+    cond_t work_available;
+    cond_t work_done;
+    uint64_t generation;
+    uint32_t busy_workers;
+    bool batch_open;
+    bool shutdown;
+
+    JobFunction function;
+    void* user_data;
+    _Atomic uint32_t remaining_jobs;
+};
+
+//set while the current thread executes jobs, nested parallel_for calls then run inline
+static THREAD_LOCAL bool inside_job_system = false;
+
+
+//JobQueue Functions
+static bool job_queue_pop(JobQueue* queue, uint32_t* job_index) {
+    uint64_t range = atomic_load_explicit(&queue->range, memory_order_acquire);
+    while (RANGE_HEAD(range) < RANGE_TAIL(range)) {
+        const uint64_t next = RANGE_PACK(RANGE_HEAD(range) + 1, RANGE_TAIL(range));
+        if (atomic_compare_exchange_weak_explicit(&queue->range, &range, next, memory_order_acq_rel, memory_order_acquire)) {
+            *job_index = RANGE_HEAD(range);
+            return true;
+        }
+    }
+    return false;
+}
+
+//takes the upper half of the victim's range, runs its first job and keeps the rest in the own (empty) queue
+static bool job_queue_steal(JobQueue* victim, JobQueue* own, uint32_t* job_index) {
+    uint64_t range = atomic_load_explicit(&victim->range, memory_order_acquire);
+    while (RANGE_HEAD(range) < RANGE_TAIL(range)) {
+        const uint32_t head = RANGE_HEAD(range);
+        const uint32_t tail = RANGE_TAIL(range);
+        const uint32_t new_tail = tail - (tail - head + 1) / 2;
+        if (atomic_compare_exchange_weak_explicit(&victim->range, &range, RANGE_PACK(head, new_tail), memory_order_acq_rel, memory_order_acquire)) {
+            *job_index = new_tail;
+            if (new_tail + 1 < tail) {
+                atomic_store_explicit(&own->range, RANGE_PACK(new_tail + 1, tail), memory_order_release);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//JobSystem Functions
+static bool job_system_next_job(JobSystem* job_system, const uint32_t queue_index, uint32_t* job_index) {
+    JobQueue* own = &job_system->queues[queue_index];
+    if (job_queue_pop(own, job_index)) {
+        return true;
+    }
+    for (uint32_t i = 1; i < job_system->number_of_threads; i++) {
+        JobQueue* victim = &job_system->queues[(queue_index + i) % job_system->number_of_threads];
+        if (job_queue_steal(victim, own, job_index)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void job_system_work(JobSystem* job_system, const uint32_t queue_index) {
+    uint32_t job_index;
+    while (job_system_next_job(job_system, queue_index, &job_index)) {
+        job_system->function(job_index, job_system->user_data);
+        atomic_fetch_sub_explicit(&job_system->remaining_jobs, 1, memory_order_acq_rel);
+    }
+}
+
+static void job_system_worker_loop(JobWorker* worker) {
+    JobSystem* job_system = worker->job_system;
+    uint64_t seen_generation = 0;
+    inside_job_system = true;
+
+    mutex_lock(&job_system->mutex);
+    for (;;) {
+        while (!job_system->shutdown && !(job_system->batch_open && job_system->generation != seen_generation)) {
+            cond_wait(&job_system->work_available, &job_system->mutex);
+        }
+        if (job_system->shutdown) {
+            break;
+        }
+        seen_generation = job_system->generation;
+        job_system->busy_workers++;
+        mutex_unlock(&job_system->mutex);
+
+        job_system_work(job_system, worker->queue_index);
+
+        mutex_lock(&job_system->mutex);
+        if (--job_system->busy_workers == 0) {
+            cond_broadcast(&job_system->work_done);
+        }
+    }
+    mutex_unlock(&job_system->mutex);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI job_system_thread_entry(LPVOID argument) {
+    job_system_worker_loop(argument);
+    return 0;
+}
+#else
+static void* job_system_thread_entry(void* argument) {
+    job_system_worker_loop(argument);
+    return NULL;
+}
+#endif
+
+JobSystem* job_system_create(uint32_t number_of_threads) {
+    if (number_of_threads == 0) {
+        number_of_threads = hardware_concurrency();
+    }
+
+    JobSystem* job_system = malloc(sizeof(JobSystem));
+    if(!job_system) exit(EXIT_FAILURE);
+
+    job_system->number_of_threads = number_of_threads;
+    job_system->generation = 0;
+    job_system->busy_workers = 0;
+    job_system->batch_open = false;
+    job_system->shutdown = false;
+    job_system->function = NULL;
+    job_system->user_data = NULL;
+    atomic_init(&job_system->remaining_jobs, 0);
+
+    mutex_init(&job_system->mutex);
+    cond_init(&job_system->work_available);
+    cond_init(&job_system->work_done);
+
+    job_system->queues = malloc(sizeof(JobQueue) * number_of_threads);
+    if(!job_system->queues) exit(EXIT_FAILURE);
+    for (uint32_t i = 0; i < number_of_threads; i++) {
+        atomic_init(&job_system->queues[i].range, 0);
+    }
+
+    //the calling thread is the first participant so only number_of_threads - 1 threads are spawned
+    const uint32_t number_of_workers = number_of_threads - 1;
+    job_system->threads = malloc(sizeof(thread_t) * (number_of_workers ? number_of_workers : 1));
+    if(!job_system->threads) exit(EXIT_FAILURE);
+    job_system->workers = malloc(sizeof(JobWorker) * (number_of_workers ? number_of_workers : 1));
+    if(!job_system->workers) exit(EXIT_FAILURE);
+
+    for (uint32_t i = 0; i < number_of_workers; i++) {
+        job_system->workers[i].job_system = job_system;
+        job_system->workers[i].queue_index = i + 1;
+#if defined(_WIN32)
+        job_system->threads[i] = CreateThread(NULL, 0, job_system_thread_entry, &job_system->workers[i], 0, NULL);
+        if(!job_system->threads[i]) exit(EXIT_FAILURE);
+#else
+        if(pthread_create(&job_system->threads[i], NULL, job_system_thread_entry, &job_system->workers[i]) != 0) exit(EXIT_FAILURE);
+#endif
+    }
+    return job_system;
+}
+
+void job_system_destroy(JobSystem* job_system) {
+    mutex_lock(&job_system->mutex);
+    job_system->shutdown = true;
+    cond_broadcast(&job_system->work_available);
+    mutex_unlock(&job_system->mutex);
+
+    for (uint32_t i = 0; i + 1 < job_system->number_of_threads; i++) {
+#if defined(_WIN32)
+        WaitForSingleObject(job_system->threads[i], INFINITE);
+        CloseHandle(job_system->threads[i]);
+#else
+        pthread_join(job_system->threads[i], NULL);
+#endif
+    }
+
+    cond_destroy(&job_system->work_done);
+    cond_destroy(&job_system->work_available);
+    mutex_destroy(&job_system->mutex);
+
+    free(job_system->workers);
+    free(job_system->threads);
+    free(job_system->queues);
+    free(job_system);
+}
+
+uint32_t job_system_number_of_threads(const JobSystem* job_system) {
+    return job_system->number_of_threads;
+}
+
+void job_system_parallel_for(JobSystem* job_system, const uint32_t number_of_jobs, const JobFunction function, void* user_data) {
+    if (number_of_jobs == 0) {
+        return;
+    }
+    //nothing to share, or we are already inside a job: run on the calling thread
+    if (job_system->number_of_threads == 1 || number_of_jobs == 1 || inside_job_system) {
+        for (uint32_t i = 0; i < number_of_jobs; i++) {
+            function(i, user_data);
+        }
+        return;
+    }
+
+    job_system->function = function;
+    job_system->user_data = user_data;
+    atomic_store_explicit(&job_system->remaining_jobs, number_of_jobs, memory_order_relaxed);
+
+    //split the jobs evenly, work stealing balances what the split gets wrong
+    const uint32_t number_of_threads = job_system->number_of_threads;
+    for (uint32_t i = 0; i < number_of_threads; i++) {
+        const uint32_t head = (uint32_t)((uint64_t)number_of_jobs * i / number_of_threads);
+        const uint32_t tail = (uint32_t)((uint64_t)number_of_jobs * (i + 1) / number_of_threads);
+        atomic_store_explicit(&job_system->queues[i].range, RANGE_PACK(head, tail), memory_order_relaxed);
+    }
+
+    mutex_lock(&job_system->mutex);
+    job_system->generation++;
+    job_system->batch_open = true;
+    cond_broadcast(&job_system->work_available);
+    mutex_unlock(&job_system->mutex);
+
+    inside_job_system = true;
+    job_system_work(job_system, 0);
+    while (atomic_load_explicit(&job_system->remaining_jobs, memory_order_acquire) != 0) {
+        thread_yield();
+    }
+    inside_job_system = false;
+
+    //no worker may still be reading the queues when the next batch refills them
+    mutex_lock(&job_system->mutex);
+    job_system->batch_open = false;
+    while (job_system->busy_workers > 0) {
+        cond_wait(&job_system->work_done, &job_system->mutex);
+    }
+    mutex_unlock(&job_system->mutex);
+}
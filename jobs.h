@@ -0,0 +1,21 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdint.h>
+
+typedef void (*JobFunction)(uint32_t job_index, void* user_data);
+
+//opaque, the layout depends on the platform thread primitives
+typedef struct JobSystem JobSystem;
+
+//number_of_threads counts the calling thread, 0 means one per hardware thread
+JobSystem* job_system_create(uint32_t number_of_threads);
+
+void job_system_destroy(JobSystem* job_system);
+
+uint32_t job_system_number_of_threads(const JobSystem* job_system);
+
+//runs function(0..number_of_jobs-1) on all threads and returns once every job is done
+void job_system_parallel_for(JobSystem* job_system, uint32_t number_of_jobs, JobFunction function, void* user_data);
+
+#endif //JOBS_H
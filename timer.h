@@ -1,4 +1,5 @@
 // --- High-Resolution C Timer Utility ---
+#include <stdint.h>
 #if defined(_WIN32)
 #include <windows.h>
 static LARGE_INTEGER timer_freq;
@@ -20,6 +21,15 @@ void stop_timer() {
     printf("  %s: %.3f ms\n", timer_name, ms);
 }
 
+static inline uint64_t timer_now_ns(void) {
+    if (timer_freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&timer_freq);
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)timer_freq.QuadPart);
+}
+
 #elif defined(__linux__) || defined(__APPLE__)
 #include <time.h>
 static struct timespec timer_start_time;
@@ -39,6 +49,12 @@ void stop_timer() {
     printf("  %s: %.3f ms\n", timer_name, ms);
 }
 
+static inline uint64_t timer_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
 #else
 // Fallback to the original low-resolution timer if no platform is recognized
 #include <time.h>
@@ -55,4 +71,8 @@ void stop_timer() {
     double ms = ((double)(end_time - timer_start_time) / CLOCKS_PER_SEC) * 1000.0;
     printf("  %s: %.3f ms\n", timer_name, ms);
 }
+
+static inline uint64_t timer_now_ns(void) {
+    return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+}
 #endif
\ No newline at end of file